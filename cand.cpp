@@ -1,4 +1,5 @@
 #include "cand.h"
+#include "util/murmur_hash.hh"
 
 bool larger( const Cand *pl, const Cand *pr )
 {
@@ -12,58 +13,185 @@ bool smaller( const Cand *pl, const Cand *pr )
 
 /************************************************************************
  1. 函数功能: 将翻译候选加入列表中, 并进行假设重组
- 2. 入口参数: 翻译候选的指针
- 3. 出口参数: 如果候选被丢弃或者替换掉原来的候选,返回false;否则返回true
- 4. 算法简介: a) 如果当前候选与优先级队列中的某个候选的目标端边界词相同,
-              a.1) 如果当前候选的得分低, 则丢弃当前候选
-              a.2) 如果当前候选的得分低, 则替换原候选
-              a.3) 如果二者得分相同, 则将当前候选加入列表
-              b) 如果当前候选与优先级队列中的所有候选的目标端边界词不同,
-	         则将当前候选加入列表
+ 2. 入口参数: 翻译候选的指针, 列表大小, 是否保留被重组掉的候选
+ 3. 出口参数: 无
+ 4. 算法简介: 得分比已有最好候选低threshold以上的候选直接丢弃, 否则
+              a) 通过重组状态的哈希值找到与当前候选语言模型状态和nnjm边界相同的候选,
+              a.1) 如果当前候选的得分不高于原候选, 则丢弃当前候选
+              a.2) 如果当前候选的得分高, 则替换原候选
+              a.3) keep_recombined为真时被丢弃的候选不释放, 而是挂到保留的候选上,
+                   供抽取n-best时使用
+              b) 如果没有可以重组的候选, 且列表已满, 则与堆顶得分最低的候选比较,
+                 保留得分高的一个
+              c) 否则将当前候选加入列表
  * **********************************************************************/
-void CandBeam::add(Cand *&cand_ptr,int beam_size)
+void CandBeam::add(Cand *&cand_ptr,int beam_size,bool keep_recombined)
 { 
-	for (auto &e_cand_ptr : data)
+	if (cand_ptr->score < best_score - threshold)
+	{
+		threshold_pruned_num++;
+		delete cand_ptr;
+		return;
+	}
+	best_score = max(best_score,cand_ptr->score);
+	cand_ptr->recomb_hash = cal_recomb_hash(cand_ptr);
+	auto it = recomb_map.find(cand_ptr->recomb_hash);
+	if (it != recomb_map.end() && is_bound_same(cand_ptr,it->second))
 	{
-		if (is_bound_same(cand_ptr,e_cand_ptr))
+		Cand *e_cand_ptr = it->second;
+		recomb_num++;
+		if (cand_ptr->tgt_str_hash == e_cand_ptr->tgt_str_hash && cand_ptr->tgt_word_num == e_cand_ptr->tgt_word_num)
+		{
+			same_str_recomb_num++;
+		}
+		if (cand_ptr->score > e_cand_ptr->score)
+		{
+			size_t idx = e_cand_ptr->beam_idx;
+			it->second = cand_ptr;
+			place(idx,cand_ptr);
+			sift_down(idx);
+			cand_ptr = e_cand_ptr;
+		}
+		if (keep_recombined)
+		{
+			Cand *kept_cand_ptr = it->second;
+			kept_cand_ptr->recombined_cands.push_back(cand_ptr);
+			kept_cand_ptr->recombined_cands.insert(kept_cand_ptr->recombined_cands.end(),cand_ptr->recombined_cands.begin(),cand_ptr->recombined_cands.end());
+			cand_ptr->recombined_cands.clear();
+		}
+		else
 		{
-			if (cand_ptr->score > e_cand_ptr->score)
-			{
-				swap(e_cand_ptr,cand_ptr);
-			}
 			delete cand_ptr;
-			return;
 		}
+		return;
 	}
 	if (data.size() >= beam_size)
 	{
-        auto &min_cand_ptr = *min_element(data.begin(),data.end(),smaller);
-        if (cand_ptr->score > min_cand_ptr->score)
-        {
-            swap(min_cand_ptr,cand_ptr);
-        }
+		Cand *min_cand_ptr = data.front();
+		if (cand_ptr->score > min_cand_ptr->score)
+		{
+			auto min_it = recomb_map.find(min_cand_ptr->recomb_hash);
+			if (min_it != recomb_map.end() && min_it->second == min_cand_ptr)
+			{
+				recomb_map.erase(min_it);
+			}
+			recomb_map.insert(make_pair(cand_ptr->recomb_hash,cand_ptr));
+			place(0,cand_ptr);
+			sift_down(0);
+			cand_ptr = min_cand_ptr;
+		}
 		delete cand_ptr;
 		return;
 	}
-	data.push_back(cand_ptr); 
+	recomb_map.insert(make_pair(cand_ptr->recomb_hash,cand_ptr));   //哈希冲突时不覆盖原有的映射
+	data.push_back(cand_ptr);
+	place(data.size()-1,cand_ptr);
+	sift_up(data.size()-1);
 }
 
-bool CandBeam::is_bound_same(const Cand *a, const Cand *b)
+//得分为score的候选能否进入列表: 不低于相对阈值, 并且列表未满或高于列表中最差的候选
+bool CandBeam::can_enter(double score,int beam_size)
 {
-	size_t len_a = a->tgt_wids.size();
-	size_t len_b = b->tgt_wids.size();
-	size_t bound_len_a = min(len_a, LM_ORDER-1);
-	size_t bound_len_b = min(len_b, LM_ORDER-1);
-	if (bound_len_a != bound_len_b)
-		return false;
-	if (bound_len_a < LM_ORDER && a->tgt_wids != b->tgt_wids)
+	if (score < best_score - threshold)
 		return false;
-	for (size_t i=0;i<bound_len_a;i++)
+	return data.size() < beam_size || score > data.front()->score;
+}
+
+//按得分从高到低排列, 并剪掉得分比最好候选低threshold以上的候选
+void CandBeam::sort()
+{
+	std::sort(data.begin(),data.end(),larger);
+	recomb_map.clear();
+	while (!data.empty() && data.back()->score < data.front()->score - threshold)
 	{
-		if (a->tgt_wids.at(i) != b->tgt_wids.at(i) || a->tgt_wids.at(len_a-1-i) != b->tgt_wids.at(len_b-1-i))
-			return false;
+		delete data.back();
+		data.pop_back();
+		threshold_pruned_num++;
+	}
+}
+
+//当前候选的重组状态, 包括语言模型状态以及nnjm边界
+uint64_t CandBeam::cal_recomb_hash(const Cand *cand)
+{
+	int bound[3*NNJM_TGT_WINDOW+1];
+	size_t bound_len = get_nnjm_bound(cand,bound);
+	return util::MurmurHashNative(bound,sizeof(int)*bound_len,hash_value(cand->lm_state));
+}
+
+/************************************************************************
+ 1. 函数功能: 获取候选中之后计算nnjm得分时还会用到的目标端边界信息
+ 2. 入口参数: 翻译候选的指针
+ 3. 出口参数: 边界信息的长度
+ 4. 算法简介: 开头NNJM_TGT_WINDOW个单词的nnjm得分尚未计算, 需要记录这些单词及其
+              对应的源端位置; 结尾NNJM_TGT_WINDOW个单词会作为后续单词的目标端历史;
+              对空的规则单词会借用相邻子候选边界单词的源端位置, 因此还需记录结尾
+              单词对应的源端位置
+ * **********************************************************************/
+size_t CandBeam::get_nnjm_bound(const Cand *cand, int *bound)
+{
+	size_t bound_len = min((size_t)cand->tgt_word_num, NNJM_TGT_WINDOW);
+	size_t n = 0;
+	for (size_t i=0;i<bound_len;i++)
+	{
+		bound[n++] = cand->left_wids[i];
+		bound[n++] = cand->left_src_idx[i];
+		bound[n++] = cand->right_wids[i];
+	}
+	if (bound_len > 0)
+	{
+		bound[n++] = cand->right_src_idx[bound_len-1];
+	}
+	return n;
+}
+
+void CandBeam::place(size_t idx, Cand *cand)
+{
+	data[idx] = cand;
+	cand->beam_idx = idx;
+}
+
+void CandBeam::sift_up(size_t idx)
+{
+	Cand *cand = data[idx];
+	while (idx > 0)
+	{
+		size_t parent = (idx-1)/2;
+		if (!smaller(cand,data[parent]))
+			break;
+		place(idx,data[parent]);
+		idx = parent;
 	}
-	return true;
+	place(idx,cand);
+}
+
+void CandBeam::sift_down(size_t idx)
+{
+	Cand *cand = data[idx];
+	size_t n = data.size();
+	while (2*idx+1 < n)
+	{
+		size_t child = 2*idx+1;
+		if (child+1 < n && smaller(data[child+1],data[child]))
+			child++;
+		if (!smaller(data[child],cand))
+			break;
+		place(idx,data[child]);
+		idx = child;
+	}
+	place(idx,cand);
+}
+
+bool CandBeam::is_bound_same(const Cand *a, const Cand *b)
+{
+	if (!(a->lm_state == b->lm_state))
+		return false;
+	int bound_a[3*NNJM_TGT_WINDOW+1];
+	int bound_b[3*NNJM_TGT_WINDOW+1];
+	size_t bound_len_a = get_nnjm_bound(a,bound_a);
+	size_t bound_len_b = get_nnjm_bound(b,bound_b);
+	if (bound_len_a != bound_len_b)
+		return false;
+	return equal(bound_a,bound_a+bound_len_a,bound_b);
 }
 
 void CandBeam::free()
@@ -73,3 +201,59 @@ void CandBeam::free()
 		delete cand;
 	}
 }
+
+void DuplicateSet::clear()
+{
+	used_num = 0;
+	generation++;
+	if (generation == 0)							//代数回绕时把所有槽位重置为未使用
+	{
+		for (auto &slot : slots)
+		{
+			slot.generation = 0;
+		}
+		generation = 1;
+	}
+}
+
+bool DuplicateSet::find_or_insert(const CubeKey &key)
+{
+	if (2*(used_num+1) > slots.size())
+	{
+		grow();
+	}
+	size_t mask = slots.size()-1;
+	for (size_t i=CubeKeyHash()(key)&mask;;i=(i+1)&mask)
+	{
+		Slot &slot = slots[i];
+		if (slot.generation != generation)
+		{
+			slot.key = key;
+			slot.generation = generation;
+			used_num++;
+			return false;
+		}
+		if (slot.key == key)
+			return true;
+	}
+}
+
+//容量翻倍, 并把当前代数的键重新插入
+void DuplicateSet::grow()
+{
+	vector<Slot> old_slots;
+	old_slots.swap(slots);
+	slots.resize(max(old_slots.size()*2,(size_t)1024));		//新槽位的代数为0
+	size_t mask = slots.size()-1;
+	for (const auto &old_slot : old_slots)
+	{
+		if (old_slot.generation != generation)
+			continue;
+		size_t i = CubeKeyHash()(old_slot.key)&mask;
+		while (slots[i].generation == generation)
+		{
+			i = (i+1)&mask;
+		}
+		slots[i] = old_slot;
+	}
+}
@@ -17,6 +17,7 @@ struct Rule
 	pair<int,int> span_x2;    //同上
 	TgtRule *tgt_rule;        //规则目标端
 	int tgt_rule_rank;		  //该目标端在源端相同的所有目标端中的排名
+	vector<TgtRule> *tgt_rules;   //源端相同的所有目标端(按得分从高到低排列), 作为立方体剪枝的第三维
 	Rule ()
 	{
 		span = make_pair(-1,-1);
@@ -24,6 +25,7 @@ struct Rule
 		span_x2 = make_pair(-1,-1);
 		tgt_rule = NULL;
 		tgt_rule_rank = 0;
+		tgt_rules = NULL;
 	}
 };
 
@@ -35,17 +37,20 @@ struct Cand
 	int rule_num;			        	//生成当前候选所使用的规则数目
 	int glue_num;			        	//生成当前候选所使用的glue规则数目
 
-	//目标端信息
+	//目标端信息, 只保存边界单词, 完整的目标端id序列通过子候选回溯得到
 	int tgt_word_num;		        	//当前候选目标端的单词数
-	vector<int> tgt_wids;	        	//当前候选目标端的id序列
-    vector<double> nnjm_ngram_score;    //目标端每个单词的nnjm ngram语言模型得分
-    vector<int> aligned_src_idx;        //目标端每个单词对应端源端位置
+	int left_wids[NNJM_TGT_WINDOW];     //目标端开头的单词(单词数不足时只有前tgt_word_num个有效), 这些单词的nnjm得分尚未计算
+	int left_src_idx[NNJM_TGT_WINDOW];  //开头每个单词对应的源端位置
+	int right_wids[NNJM_TGT_WINDOW];    //目标端结尾的单词
+	int right_src_idx[NNJM_TGT_WINDOW]; //结尾每个单词对应的源端位置
+	uint64_t tgt_str_hash;              //目标端id序列的哈希值
 
 	//打分信息
 	double score;				        //当前候选的总得分
 	vector<double> trans_probs;	        //翻译概率
 	double lm_prob;
 	double nnjm_prob;
+	bool is_scored;						//是否已经计算语言模型和nnjm得分, 延迟打分时入队的候选为false, score只是估计值
 
 	//合并信息,记录通过规则生成当前候选时的相关信息，注意可能只有一个子候选
 	Rule applied_rule;                  //生成当前候选所使用的规则
@@ -57,6 +62,11 @@ struct Cand
 	//语言模型状态信息
 	lm::ngram::ChartState lm_state;
 
+	//假设重组信息
+	uint64_t recomb_hash;				//重组状态的哈希值, 加入CandBeam时计算
+	int beam_idx;						//当前候选在CandBeam的最小堆中的位置
+	vector<Cand*> recombined_cands;		//被当前候选重组掉的候选, 抽取n-best时作为当前节点的其他入边, 由当前候选负责释放
+
 	Cand ()
 	{
         span = make_pair(-1,-1);
@@ -64,18 +74,29 @@ struct Cand
 		glue_num = 0;
 
 		tgt_word_num = 1;
-		tgt_wids.clear();
+		tgt_str_hash = 0;
 
 		score = 0.0;
 		trans_probs.clear();
 		lm_prob = 0.0;
 		nnjm_prob = 0.0;
+		is_scored = true;
 
 		rank_x1 = 0;
 		rank_x2 = 0;
 
 		child_x1 = NULL;
 		child_x2 = NULL;
+
+		recomb_hash = 0;
+		beam_idx = -1;
+	}
+	~Cand ()
+	{
+		for (auto cand : recombined_cands)
+		{
+			delete cand;
+		}
 	}
 };
 
@@ -91,22 +112,103 @@ bool larger( const Cand *pl, const Cand *pr );
 bool smaller( const Cand *pl, const Cand *pr );
 
 //将跨度相同的候选组织到列表中
+//加入候选期间data是按得分组织的最小堆, 调用sort之后按得分从高到低排列, 此后不能再加入候选
 class CandBeam
 {
 	public:
-		void add(Cand *&cand_ptr,int beam_size);
+		CandBeam () : recomb_num(0), same_str_recomb_num(0), threshold(numeric_limits<double>::infinity()),
+		              best_score(-numeric_limits<double>::infinity()), threshold_pruned_num(0) {}
+		void add(Cand *&cand_ptr,int beam_size,bool keep_recombined=false);
+		bool can_enter(double score,int beam_size);
+		void set_threshold(double i_threshold) { threshold = i_threshold; }
 		Cand* top() { return data.front(); }
 		Cand* at(size_t i) { return data.at(i);}
 		int size() { return data.size();  }
-		void sort() { std::sort(data.begin(),data.end(),larger); }
+		void sort();
 		void free();
+		size_t get_recomb_num() { return recomb_num; }
+		size_t get_same_str_recomb_num() { return same_str_recomb_num; }
+		size_t get_threshold_pruned_num() { return threshold_pruned_num; }
 	private:
+		uint64_t cal_recomb_hash(const Cand *cand);
+		size_t get_nnjm_bound(const Cand *cand, int *bound);
 		bool is_bound_same(const Cand *a, const Cand *b);
+		void place(size_t idx, Cand *cand);
+		void sift_up(size_t idx);
+		void sift_down(size_t idx);
 
 	private:
 		vector<Cand*> data;
+		unordered_map<uint64_t,Cand*> recomb_map;		//重组状态的哈希值到候选的映射
+		size_t recomb_num;								//假设重组的次数
+		size_t same_str_recomb_num;						//假设重组时两个候选目标端完全相同的次数
+		double threshold;								//相对阈值, 得分比最好候选低出该值的候选被剪掉
+		double best_score;								//已加入的候选中的最高得分
+		size_t threshold_pruned_num;					//被相对阈值剪掉的候选数
 };
 
 typedef priority_queue<Cand*, vector<Cand*>, cmp> Candpq;
 
+//生成候选时使用的压缩目标端序列, 由规则中的终结符以及子候选的边界单词组成, 子候选中间的单词被省略
+struct TgtSeq
+{
+	vector<int> wids;                   //目标端单词id
+	vector<int> src_idx;                //每个单词对应的源端位置
+	vector<int> pos;                    //每个单词在候选完整目标端序列中的位置
+	vector<bool> unscored;              //每个单词的nnjm得分是否尚未计算
+	void clear() { wids.clear(); src_idx.clear(); pos.clear(); unscored.clear(); }
+	void push_back(int wid, int idx, int p, bool flag) { wids.push_back(wid); src_idx.push_back(idx); pos.push_back(p); unscored.push_back(flag); }
+	size_t size() const { return wids.size(); }
+};
+
+//立方体剪枝中用来检查候选是否已经被加入优先级队列的键
+//span_key依次存放两个变量的源端起始位置和跨度(各16位), rank_key依次存放规则目标端排名以及两个子候选的排名(各21位)
+//所有字段都加1后存储, 因此全0的键不会出现, 可以作为哈希表的空槽标记
+struct CubeKey
+{
+	uint64_t span_key;
+	uint64_t rank_key;
+	CubeKey () : span_key(0), rank_key(0) {}
+	CubeKey (const Rule &rule, int rank_x1, int rank_x2)
+	{
+		span_key = (uint64_t)(rule.span_x1.first+1)<<48 | (uint64_t)(rule.span_x1.second+1)<<32
+			     | (uint64_t)(rule.span_x2.first+1)<<16 | (uint64_t)(rule.span_x2.second+1);
+		rank_key = (uint64_t)(rule.tgt_rule_rank+1)<<42 | (uint64_t)(rank_x1+1)<<21 | (uint64_t)(rank_x2+1);
+	}
+	bool operator==(const CubeKey &rhs) const { return span_key == rhs.span_key && rank_key == rhs.rank_key; }
+};
+
+struct CubeKeyHash
+{
+	size_t operator() (const CubeKey &key) const
+	{
+		uint64_t h = key.span_key * 0x9E3779B97F4A7C15ULL ^ key.rank_key;
+		return h ^ (h >> 29);
+	}
+};
+
+//立方体剪枝中记录已经加入优先级队列的候选的开放寻址哈希表, 在所有跨度之间复用
+//每个槽位记录写入时的代数, 代数与当前代数相同的槽位才有效, 因此清空时只需把当前代数加1,
+//代价与容量无关; 表在写满一半时扩容, 容量只增不减
+class DuplicateSet
+{
+	public:
+		DuplicateSet () : generation(1), used_num(0) {}
+		void clear();
+		bool find_or_insert(const CubeKey &key);		//键已经存在时返回true, 否则插入并返回false
+
+	private:
+		void grow();
+
+	private:
+		struct Slot
+		{
+			CubeKey key;
+			uint32_t generation;
+		};
+		vector<Slot> slots;								//容量为2的幂
+		uint32_t generation;							//当前代数, 槽位的代数为0表示从未使用
+		size_t used_num;								//当前代数的键数
+};
+
 #endif
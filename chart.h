@@ -0,0 +1,49 @@
+#ifndef CHART_H
+#define CHART_H
+#include "stdafx.h"
+
+//按三角形连续存储的chart, 段落中所有跨度的元素存放在同一块内存中, chart(beg,span)为起始位置为beg, 跨度为span的元素
+//句首位置的行延伸到句尾(glue规则需要所有句子前缀), 其他位置的行最多包含ROW_MAX个跨度, 更长的跨度不可能由规则生成;
+//EOS以及不属于任何句子的位置对应的行为空
+//访问元素时只在调试时(没有定义NDEBUG)断言跨度在chart中, 不确定跨度是否在chart中时先调用contains
+template <class T, size_t ROW_MAX>
+class Chart
+{
+	public:
+		void init(const vector<pair<int,int> > &sen_spans, size_t len)
+		{
+			vector<size_t> row_sizes(len,0);
+			for (auto &sen_span : sen_spans)
+			{
+				size_t sen_end = sen_span.first + sen_span.second + 1;
+				for (size_t beg=sen_span.first;beg<sen_end;beg++)
+				{
+					row_sizes.at(beg) = beg == sen_span.first ? sen_end-beg : min(sen_end-beg,ROW_MAX);
+				}
+			}
+			row_offsets.resize(len+1);
+			row_offsets[0] = 0;
+			for (size_t beg=0;beg<len;beg++)
+			{
+				row_offsets[beg+1] = row_offsets[beg] + row_sizes[beg];
+			}
+			data.clear();
+			data.resize(row_offsets[len]);
+		}
+		T& operator()(size_t beg, size_t span) { assert(contains(beg,span)); return data[row_offsets[beg]+span]; }
+		size_t row_size(size_t beg) const { return row_offsets[beg+1] - row_offsets[beg]; }
+		bool contains(size_t beg, size_t span) const { return beg+1 < row_offsets.size() && span < row_size(beg); }
+		void fill(const T &value) { std::fill(data.begin(),data.end(),value); }
+		typename vector<T>::iterator begin() { return data.begin(); }
+		typename vector<T>::iterator end() { return data.end(); }
+
+	private:
+		vector<T> data;
+		vector<size_t> row_offsets;			//每行第一个元素在data中的位置, 最后一个元素为data的大小
+};
+
+//非句首位置的行的最大长度, XAX规则的跨度最多可达SPAN_LEN_MAX+3个单词
+const size_t CHART_ROW_MAX = SPAN_LEN_MAX + 3;
+static_assert(RULE_LEN_MAX <= CHART_ROW_MAX, "phrase rules must fit in a chart row");
+
+#endif
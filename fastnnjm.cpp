@@ -0,0 +1,376 @@
+#include "fastnnjm.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNJM_X86
+#endif
+
+//标量核函数, 在不支持AVX2的CPU上使用, 也作为其他核函数的参照
+static float dot_f32_scalar(const float *w, const float *x, int n)
+{
+	float sum = 0;
+	for (int i=0;i<n;i++)
+		sum += w[i]*x[i];
+	return sum;
+}
+
+static float dot_i8_scalar(const int8_t *w, const float *x, int n)
+{
+	float sum = 0;
+	for (int i=0;i<n;i++)
+		sum += w[i]*x[i];
+	return sum;
+}
+
+static void axpy_f32_scalar(float *y, const float *x, float a, int n)
+{
+	for (int i=0;i<n;i++)
+		y[i] += a*x[i];
+}
+
+static void axpy_i8_scalar(float *y, const int8_t *x, float a, int n)
+{
+	for (int i=0;i<n;i++)
+		y[i] += a*x[i];
+}
+
+#ifdef NNJM_X86
+//AVX2核函数, n为16的整数倍(见NNJM_SIMD_WIDTH), 每次处理两个8元素向量
+__attribute__((target("avx2,fma")))
+static float hsum256(__m256 v)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v),_mm256_extractf128_ps(v,1));
+	s = _mm_add_ps(s,_mm_movehl_ps(s,s));
+	s = _mm_add_ss(s,_mm_shuffle_ps(s,s,1));
+	return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_f32_avx2(const float *w, const float *x, int n)
+{
+	__m256 s0 = _mm256_setzero_ps();
+	__m256 s1 = _mm256_setzero_ps();
+	for (int i=0;i<n;i+=16)
+	{
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(w+i),_mm256_loadu_ps(x+i),s0);
+		s1 = _mm256_fmadd_ps(_mm256_loadu_ps(w+i+8),_mm256_loadu_ps(x+i+8),s1);
+	}
+	return hsum256(_mm256_add_ps(s0,s1));
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_i8_avx2(const int8_t *w, const float *x, int n)
+{
+	__m256 s0 = _mm256_setzero_ps();
+	__m256 s1 = _mm256_setzero_ps();
+	for (int i=0;i<n;i+=16)
+	{
+		__m128i w8 = _mm_loadu_si128((const __m128i*)(w+i));
+		__m256 w0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(w8));
+		__m256 w1 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(w8,8)));
+		s0 = _mm256_fmadd_ps(w0,_mm256_loadu_ps(x+i),s0);
+		s1 = _mm256_fmadd_ps(w1,_mm256_loadu_ps(x+i+8),s1);
+	}
+	return hsum256(_mm256_add_ps(s0,s1));
+}
+
+__attribute__((target("avx2,fma")))
+static void axpy_f32_avx2(float *y, const float *x, float a, int n)
+{
+	__m256 va = _mm256_set1_ps(a);
+	for (int i=0;i<n;i+=8)
+		_mm256_storeu_ps(y+i,_mm256_fmadd_ps(va,_mm256_loadu_ps(x+i),_mm256_loadu_ps(y+i)));
+}
+
+__attribute__((target("avx2,fma")))
+static void axpy_i8_avx2(float *y, const int8_t *x, float a, int n)
+{
+	__m256 va = _mm256_set1_ps(a);
+	for (int i=0;i<n;i+=8)
+	{
+		__m256 vx = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x+i))));
+		_mm256_storeu_ps(y+i,_mm256_fmadd_ps(va,vx,_mm256_loadu_ps(y+i)));
+	}
+}
+
+//AVX-512核函数, n为16的整数倍, 每次处理一个16元素向量
+__attribute__((target("avx512f")))
+static float dot_f32_avx512(const float *w, const float *x, int n)
+{
+	__m512 s = _mm512_setzero_ps();
+	for (int i=0;i<n;i+=16)
+		s = _mm512_fmadd_ps(_mm512_loadu_ps(w+i),_mm512_loadu_ps(x+i),s);
+	return _mm512_reduce_add_ps(s);
+}
+
+__attribute__((target("avx512f")))
+static float dot_i8_avx512(const int8_t *w, const float *x, int n)
+{
+	__m512 s = _mm512_setzero_ps();
+	for (int i=0;i<n;i+=16)
+	{
+		__m512 vw = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(w+i))));
+		s = _mm512_fmadd_ps(vw,_mm512_loadu_ps(x+i),s);
+	}
+	return _mm512_reduce_add_ps(s);
+}
+
+__attribute__((target("avx512f")))
+static void axpy_f32_avx512(float *y, const float *x, float a, int n)
+{
+	__m512 va = _mm512_set1_ps(a);
+	for (int i=0;i<n;i+=16)
+		_mm512_storeu_ps(y+i,_mm512_fmadd_ps(va,_mm512_loadu_ps(x+i),_mm512_loadu_ps(y+i)));
+}
+
+__attribute__((target("avx512f")))
+static void axpy_i8_avx512(float *y, const int8_t *x, float a, int n)
+{
+	__m512 va = _mm512_set1_ps(a);
+	for (int i=0;i<n;i+=16)
+	{
+		__m512 vx = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(x+i))));
+		_mm512_storeu_ps(y+i,_mm512_fmadd_ps(va,vx,_mm512_loadu_ps(y+i)));
+	}
+}
+#endif
+
+//检测CPU支持的最好的指令集
+NnjmIsa FastNnjm::detect_isa()
+{
+#ifdef NNJM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return NNJM_ISA_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return NNJM_ISA_AVX2;
+#endif
+	return NNJM_ISA_SCALAR;
+}
+
+const char* FastNnjm::get_isa_name(NnjmIsa isa)
+{
+	if (isa == NNJM_ISA_AVX512)
+		return "avx512";
+	if (isa == NNJM_ISA_AVX2)
+		return "avx2";
+	return "scalar";
+}
+
+/**************************************************************************************
+ 1. 函数功能: 由neuralLM创建只用于推理的nnjm
+ 2. 入口参数: 已经读入(premultiply)的nnjm, 是否将权重量化为int8, 使用的指令集
+ 3. 出口参数: 无
+ 4. 算法简介: a) 第一隐层premultiply后每个(上下文位置, 单词)对应权重矩阵的一列, 转置后按行存储,
+                 查询时只需把上下文单词对应的行相加
+              b) 第二隐层和输出层按行存储, 每个输出神经元的值为一行权重与输入的点积
+              c) 指令集不被CPU支持时退回到检测到的最好的指令集
+************************************************************************************* */
+FastNnjm::FastNnjm(const neuralLM &nnjm, bool i_use_int8, NnjmIsa i_isa)
+{
+	const model &nn = nnjm.get_model();
+	assert(nn.premultiplied);
+	use_int8 = i_use_int8;
+	isa = min(i_isa,detect_isa());
+	normalization = nnjm.get_normalization();
+	weight = nnjm.get_weight();
+	ngram_size = nn.ngram_size;
+	input_vocab_size = nn.input_vocab_size;
+	activation = nn.activation_function;
+	if (activation != Rectifier && activation != Tanh && activation != HardTanh && activation != Identity)
+	{
+		cerr<<"unsupported activation function in nnjm model: "<<activation<<endl;
+		exit(EXIT_FAILURE);
+	}
+
+	const Matrix<double,Dynamic,Dynamic> &U1 = nn.first_hidden_linear.get_U();
+	init_layer(first_layer,U1.cols(),U1.rows(),use_int8);
+	for (int i=0;i<U1.cols();i++)
+	{
+		set_layer_row(first_layer,i,U1.data()+(size_t)i*U1.rows(),1);                 //列优先存储, 一列连续
+	}
+	const Matrix<double,Dynamic,Dynamic> &U2 = nn.second_hidden_linear.get_U();
+	init_layer(second_layer,U2.rows(),U2.cols(),use_int8);
+	for (int i=0;i<U2.rows();i++)
+	{
+		set_layer_row(second_layer,i,U2.data()+i,U2.rows());                          //一行的元素间隔为行数
+	}
+	const Matrix<double,Dynamic,Dynamic,Eigen::RowMajor> &W = nn.output_layer.get_W();
+	init_layer(output_layer,W.rows(),W.cols(),use_int8);
+	for (int i=0;i<W.rows();i++)
+	{
+		set_layer_row(output_layer,i,W.data()+(size_t)i*W.cols(),1);
+	}
+	const Matrix<double,Dynamic,1> &b = nn.output_layer.get_b();
+	output_biases.assign(b.data(),b.data()+b.size());
+
+	dot_f32 = dot_f32_scalar;
+	dot_i8 = dot_i8_scalar;
+	axpy_f32 = axpy_f32_scalar;
+	axpy_i8 = axpy_i8_scalar;
+#ifdef NNJM_X86
+	if (isa == NNJM_ISA_AVX2)
+	{
+		dot_f32 = dot_f32_avx2;
+		dot_i8 = dot_i8_avx2;
+		axpy_f32 = axpy_f32_avx2;
+		axpy_i8 = axpy_i8_avx2;
+	}
+	else if (isa == NNJM_ISA_AVX512)
+	{
+		dot_f32 = dot_f32_avx512;
+		dot_i8 = dot_i8_avx512;
+		axpy_f32 = axpy_f32_avx512;
+		axpy_i8 = axpy_i8_avx512;
+	}
+#endif
+}
+
+void FastNnjm::init_layer(Layer &layer, int rows, int cols, bool quantize)
+{
+	layer.rows = rows;
+	layer.cols = cols;
+	layer.stride = (cols+NNJM_SIMD_WIDTH-1)/NNJM_SIMD_WIDTH*NNJM_SIMD_WIDTH;
+	if (quantize)
+	{
+		layer.w8.assign((size_t)rows*layer.stride,0);
+		layer.scales.assign(rows,0.0);
+	}
+	else
+	{
+		layer.w.assign((size_t)rows*layer.stride,0.0);
+	}
+}
+
+//设置一行权重, values[k*step]为第k个元素; int8时缩放因子为该行绝对值最大的元素除以127
+void FastNnjm::set_layer_row(Layer &layer, int row, const double *values, size_t step)
+{
+	size_t offset = (size_t)row*layer.stride;
+	if (layer.w8.empty())
+	{
+		for (int k=0;k<layer.cols;k++)
+		{
+			layer.w[offset+k] = values[k*step];
+		}
+		return;
+	}
+	double max_abs = 0.0;
+	for (int k=0;k<layer.cols;k++)
+	{
+		max_abs = max(max_abs,fabs(values[k*step]));
+	}
+	double scale = max_abs > 0 ? max_abs/127.0 : 1.0;
+	layer.scales[row] = scale;
+	for (int k=0;k<layer.cols;k++)
+	{
+		layer.w8[offset+k] = (int8_t)lround(values[k*step]/scale);
+	}
+}
+
+//一行权重与x的点积, x的长度至少为该层的stride, 补齐部分的值不影响结果
+float FastNnjm::dot_row(const Layer &layer, int row, const float *x) const
+{
+	size_t offset = (size_t)row*layer.stride;
+	if (use_int8)
+		return layer.scales[row]*dot_i8(layer.w8.data()+offset,x,layer.stride);
+	return dot_f32(layer.w.data()+offset,x,layer.stride);
+}
+
+//把ngram中位置[beg,end)的上下文单词对应的第一隐层权重行加到hidden上
+void FastNnjm::add_first_layer_rows(const int *ngram, int beg, int end, float *hidden) const
+{
+	for (int i=beg;i<end;i++)
+	{
+		int row = i*input_vocab_size + ngram[i-beg];
+		size_t offset = (size_t)row*first_layer.stride;
+		if (use_int8)
+			axpy_i8(hidden,first_layer.w8.data()+offset,first_layer.scales[row],first_layer.stride);
+		else
+			axpy_f32(hidden,first_layer.w.data()+offset,1.0f,first_layer.stride);
+	}
+}
+
+void FastNnjm::activate(float *values, int n) const
+{
+	switch (activation)
+	{
+		case Rectifier:
+			for (int i=0;i<n;i++)
+				values[i] = max(values[i],0.0f);
+			break;
+		case Tanh:
+			for (int i=0;i<n;i++)
+				values[i] = tanh(values[i]);
+			break;
+		case HardTanh:
+			for (int i=0;i<n;i++)
+				values[i] = min(max(values[i],-1.0f),1.0f);
+			break;
+		case Identity:
+			break;
+		default:
+			cerr<<"unsupported activation function in nnjm model: "<<activation<<endl;
+			exit(EXIT_FAILURE);
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 由第一隐层的线性输出计算当前单词的得分
+ 2. 入口参数: 第一隐层的线性输出(长度为first_layer.stride, 会被修改), 当前单词在输出词表中的id
+ 3. 出口参数: 当前单词的对数概率(自归一化时为未归一化的得分)
+ 4. 算法简介: 第一隐层激活后与第二隐层的每一行做点积, 再激活后与输出层当前单词一行做点积;
+              需要归一化时计算输出层所有行的得分以及它们的logsum
+************************************************************************************* */
+double FastNnjm::fprop_from_first_hidden(float *hidden, int output) const
+{
+	thread_local vector<float> second_hidden;
+	second_hidden.assign(second_layer.rows+NNJM_SIMD_WIDTH,0.0f);
+	activate(hidden,first_layer.cols);
+	for (int r=0;r<second_layer.rows;r++)
+	{
+		second_hidden[r] = dot_row(second_layer,r,hidden);
+	}
+	activate(second_hidden.data(),second_layer.rows);
+	double score = dot_row(output_layer,output,second_hidden.data()) + output_biases[output];
+	if (normalization)
+	{
+		thread_local vector<double> scores;
+		scores.resize(output_layer.rows);
+		for (int r=0;r<output_layer.rows;r++)
+		{
+			scores[r] = dot_row(output_layer,r,second_hidden.data()) + output_biases[r];
+		}
+		double max_score = *max_element(scores.begin(),scores.end());
+		double sum = 0.0;
+		for (auto s : scores)
+		{
+			sum += exp(s-max_score);
+		}
+		score -= max_score + log(sum);
+	}
+	return weight*score;
+}
+
+//计算前n个上下文单词对第一隐层的贡献, partial的长度为get_hidden_dim()补齐到NNJM_SIMD_WIDTH的整数倍
+void FastNnjm::precompute_prefix(const int *prefix, int n, float *partial) const
+{
+	fill(partial,partial+first_layer.stride,0.0f);
+	add_first_layer_rows(prefix,0,n,partial);
+}
+
+//查询一个完整的ngram(ngram_size个id, 最后一个为当前单词)
+double FastNnjm::lookup_ngram(const int *ngram) const
+{
+	thread_local vector<float> hidden;
+	hidden.assign(first_layer.stride,0.0f);
+	add_first_layer_rows(ngram,0,ngram_size-1,hidden.data());
+	return fprop_from_first_hidden(hidden.data(),ngram[ngram_size-1]);
+}
+
+//查询前n个上下文单词已经由precompute_prefix计算的ngram, suffix为其余的ngram_size-n个id
+double FastNnjm::lookup_ngram_with_prefix(const float *partial, int n, const int *suffix) const
+{
+	thread_local vector<float> hidden;
+	hidden.assign(partial,partial+first_layer.stride);
+	add_first_layer_rows(suffix,n,ngram_size-1,hidden.data());
+	return fprop_from_first_hidden(hidden.data(),suffix[ngram_size-1-n]);
+}
@@ -0,0 +1,65 @@
+#ifndef FASTNNJM_H
+#define FASTNNJM_H
+#include "stdafx.h"
+#include "cand.h"
+
+const int NNJM_SIMD_WIDTH = 16;						//权重矩阵每行补齐到的元素个数, 对应一个AVX-512 float向量
+
+//推理用的指令集, 运行时根据CPU特性选择
+enum NnjmIsa {NNJM_ISA_SCALAR, NNJM_ISA_AVX2, NNJM_ISA_AVX512};
+
+//只用于解码的nnjm, 将neuralLM的权重转换为float32, 或者带每行缩放因子的int8,
+//前向计算(第一隐层的列求和, 两个隐层以及输出层当前单词一行的点积)使用按指令集选择的SIMD核函数
+//创建后只读, 可以在线程之间共享; 必须由已经premultiply的模型(neuralLM::read的结果)创建
+class FastNnjm
+{
+	public:
+		FastNnjm(const neuralLM &nnjm, bool use_int8, NnjmIsa isa);
+		int get_hidden_dim() const { return first_layer.cols; }
+		void precompute_prefix(const int *prefix, int n, float *partial) const;
+		double lookup_ngram(const int *ngram) const;
+		double lookup_ngram_with_prefix(const float *partial, int n, const int *suffix) const;
+		NnjmIsa get_isa() const { return isa; }
+		bool is_int8() const { return use_int8; }
+		static NnjmIsa detect_isa();
+		static const char* get_isa_name(NnjmIsa isa);
+
+	private:
+		//行优先存储的权重矩阵, 每行补齐到NNJM_SIMD_WIDTH的整数倍, 补齐部分为0
+		//int8时每行的实际权重为w8[i]*scales[row]
+		struct Layer
+		{
+			int rows;
+			int cols;
+			int stride;
+			vector<float> w;
+			vector<int8_t> w8;
+			vector<float> scales;
+		};
+		void init_layer(Layer &layer, int rows, int cols, bool quantize);
+		void set_layer_row(Layer &layer, int row, const double *values, size_t step);
+		void add_first_layer_rows(const int *ngram, int beg, int end, float *hidden) const;
+		void activate(float *values, int n) const;
+		double fprop_from_first_hidden(float *hidden, int output) const;
+		float dot_row(const Layer &layer, int row, const float *x) const;
+
+	private:
+		bool use_int8;
+		NnjmIsa isa;
+		bool normalization;
+		double weight;
+		int ngram_size;
+		int input_vocab_size;
+		activation_function_type activation;
+		Layer first_layer;								//premultiply后的第一隐层, 每个(上下文位置, 单词)对应一行
+		Layer second_layer;
+		Layer output_layer;
+		vector<float> output_biases;
+		//按指令集选择的核函数, dot_*返回x与一行权重的点积, axpy_*计算y += a*x
+		float (*dot_f32)(const float *w, const float *x, int n);
+		float (*dot_i8)(const int8_t *w, const float *x, int n);
+		void (*axpy_f32)(float *y, const float *x, float a, int n);
+		void (*axpy_i8)(float *y, const int8_t *x, float a, int n);
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "myutils.h"
+#include "lm/model.hh"
+const int LEN = 4096;
+
+//读取ruletable2bin生成的目标端词表, 每行为"单词 id"
+void load_vocab(const string &vocab_filename, set<string> &vocab)
+{
+	ifstream fin(vocab_filename.c_str());
+	if (!fin.is_open())
+	{
+		cout<<"fail to open "<<vocab_filename<<endl;
+		exit(EXIT_FAILURE);
+	}
+	string line;
+	while(getline(fin,line))
+	{
+		vector<string> vs;
+		Split(vs,line);
+		if (vs.size() == 2)
+		{
+			vocab.insert(vs[0]);
+		}
+	}
+	vocab.insert("<s>");                                        //句首句尾以及未登录词总会被查询
+	vocab.insert("</s>");
+	vocab.insert("<unk>");
+}
+
+/**************************************************************************************
+ 1. 函数功能: 过滤ARPA格式的语言模型, 只保留所有单词都在目标端词表中的n-gram
+ 2. 入口参数: 目标端词表, 输入的ARPA文件(可以是gzip压缩的), 输出的ARPA文件
+ 3. 出口参数: 无
+ 4. 算法简介: a) 保留的n-gram的所有子n-gram也都只包含词表中的单词, 因此过滤后的模型仍然完整,
+                 对词表内单词序列的打分与原模型完全相同
+              b) ARPA文件头需要每阶的n-gram数, 因此先将过滤后的n-gram写入临时文件并计数,
+                 最后写文件头并拼接临时文件
+************************************************************************************* */
+void filter_arpa(const set<string> &vocab, const string &arpa_filename, const string &out_filename)
+{
+	gzFile gzfp = gzopen(arpa_filename.c_str(),"r");
+	if (!gzfp)
+	{
+		cout<<"fail to open "<<arpa_filename<<endl;
+		exit(EXIT_FAILURE);
+	}
+	string body_filename = out_filename + ".body";
+	ofstream fbody(body_filename.c_str());
+	if (!fbody.is_open())
+	{
+		cout<<"fail to open "<<body_filename<<" to write!\n";
+		exit(EXIT_FAILURE);
+	}
+	vector<size_t> old_counts;
+	vector<size_t> new_counts;
+	int order = 0;                                              //当前所在的n-gram段, 0表示文件头
+	char buf[LEN];
+	while( gzgets(gzfp,buf,LEN) != Z_NULL)
+	{
+		string line(buf);
+		TrimLine(line);
+		if (line.empty() || line == "\\data\\" || line == "\\end\\")
+			continue;
+		if (order == 0 && line.compare(0,6,"ngram ") == 0)
+		{
+			old_counts.push_back(stoull(line.substr(line.find('=')+1)));
+			continue;
+		}
+		if (line[0] == '\\')                                    //形如"\3-grams:"的段首
+		{
+			order = stoi(line.substr(1));
+			new_counts.resize(order,0);
+			fbody<<"\n"<<line<<"\n";
+			continue;
+		}
+		vector<string> vs;
+		Split(vs,line);                                         //概率, order个单词, 可选的回退权重
+		bool in_vocab = vs.size() >= order+1;
+		for (int i=1;i<=order && in_vocab;i++)
+		{
+			in_vocab = vocab.count(vs[i]) > 0;
+		}
+		if (in_vocab)
+		{
+			fbody<<line<<"\n";
+			new_counts[order-1]++;
+		}
+	}
+	gzclose(gzfp);
+	fbody<<"\n\\end\\\n";
+	fbody.close();
+
+	ofstream fout(out_filename.c_str());
+	if (!fout.is_open())
+	{
+		cout<<"fail to open "<<out_filename<<" to write!\n";
+		exit(EXIT_FAILURE);
+	}
+	fout<<"\\data\\\n";
+	for (size_t i=0;i<new_counts.size();i++)
+	{
+		fout<<"ngram "<<i+1<<"="<<new_counts[i]<<"\n";
+		cout<<i+1<<"-grams: "<<old_counts.at(i)<<" -> "<<new_counts[i]<<endl;
+	}
+	ifstream fbody_in(body_filename.c_str());
+	fout<<fbody_in.rdbuf();
+	fout.close();
+	fbody_in.close();
+	remove(body_filename.c_str());
+}
+
+//用过滤后的ARPA文件构建KenLM的二进制模型(probing格式, 与解码器使用的lm::ngram::Model一致)
+void build_binary(const string &arpa_filename, const string &binary_filename)
+{
+	lm::ngram::Config config;
+	config.write_mmap = binary_filename.c_str();
+	lm::ngram::Model model(arpa_filename.c_str(),config);
+}
+
+int main(int argc,char* argv[])
+{
+	if(argc < 4)
+	{
+		cout<<"usage: ./filterlm vocab.en lm.arpa[.gz] out.bin [out.arpa]\n";
+		cout<<"       keep only n-grams over the words of vocab.en and build a KenLM binary\n";
+		cout<<"       the input must be ARPA, since n-grams cannot be enumerated from a KenLM binary\n";
+		return 0;
+	}
+	string vocab_filename(argv[1]);
+	string arpa_filename(argv[2]);
+	string binary_filename(argv[3]);
+	string out_arpa_filename = argc > 4 ? argv[4] : binary_filename + ".arpa";
+	set<string> vocab;
+	load_vocab(vocab_filename,vocab);
+	filter_arpa(vocab,arpa_filename,out_arpa_filename);
+	build_binary(out_arpa_filename,binary_filename);
+	return 0;
+}
@@ -0,0 +1,112 @@
+#include "kbest.h"
+
+/************************************************************************
+ 1. 函数功能: 获取以当前节点为根的第k个推导(k从0开始)
+ 2. 入口参数: 节点, 推导的排名
+ 3. 出口参数: 推导的指针, 推导数不足k+1个时返回NULL
+ 4. 算法简介: 调用lazy_kth_best按需展开, 返回的指针在抽取器的生命周期内有效
+ * **********************************************************************/
+const Deriv* KbestExtractor::get_kth_deriv(Cand *node, size_t k)
+{
+	lazy_kth_best(node,k);
+	NodeState &state = node_states[node];
+	if (k < state.derivs.size())
+		return &state.derivs.at(k);
+	return NULL;
+}
+
+/************************************************************************
+ 1. 函数功能: 保证节点的前k+1个推导已经确定
+ 2. 入口参数: 节点, 推导的排名
+ 3. 出口参数: 无
+ 4. 算法简介: a) 第一次访问节点时, 将每条入边的最好推导加入候选推导
+              b) 每次取出新推导之前, 先将上一个取出的推导的邻居加入候选推导,
+                 然后取出得分最高的候选推导, 直到得到k+1个推导或者候选推导为空
+ * **********************************************************************/
+void KbestExtractor::lazy_kth_best(Cand *node, size_t k)
+{
+	NodeState &state = node_states[node];
+	if (!state.is_initialized)
+	{
+		state.is_initialized = true;
+		Deriv deriv;
+		if (make_deriv(node,0,0,deriv))
+		{
+			state.cand_derivs.push(deriv);
+		}
+		for (auto edge : node->recombined_cands)
+		{
+			if (make_deriv(edge,0,0,deriv))
+			{
+				state.cand_derivs.push(deriv);
+			}
+		}
+	}
+	while (state.derivs.size() <= k)
+	{
+		if (!state.derivs.empty())
+		{
+			lazy_next(state,state.derivs.back());
+		}
+		if (state.cand_derivs.empty())
+			break;
+		state.derivs.push_back(state.cand_derivs.top());
+		state.cand_derivs.pop();
+	}
+}
+
+//将推导在每个子节点上排名加1得到的邻居推导加入候选推导
+void KbestExtractor::lazy_next(NodeState &state, const Deriv &deriv)
+{
+	Cand *edge = deriv.edge;
+	vector<pair<int,int> > neighbour_ranks;
+	if (edge->child_x1 != NULL)
+	{
+		neighbour_ranks.push_back(make_pair(deriv.rank_x1+1,deriv.rank_x2));
+	}
+	if (edge->child_x2 != NULL)
+	{
+		neighbour_ranks.push_back(make_pair(deriv.rank_x1,deriv.rank_x2+1));
+	}
+	for (auto &ranks : neighbour_ranks)
+	{
+		if (!state.visited.insert(make_pair(edge,ranks)).second)
+			continue;
+		Deriv neighbour;
+		if (make_deriv(edge,ranks.first,ranks.second,neighbour))
+		{
+			state.cand_derivs.push(neighbour);
+		}
+	}
+}
+
+/************************************************************************
+ 1. 函数功能: 根据入边以及子节点推导的排名构造推导
+ 2. 入口参数: 入边, 两个子节点推导的排名
+ 3. 出口参数: 构造的推导, 子节点推导数不足时返回false
+ 4. 算法简介: 入边的得分中已经包含了子节点最好推导的得分, 将其替换为所用子推导的得分
+ * **********************************************************************/
+bool KbestExtractor::make_deriv(Cand *edge, int rank_x1, int rank_x2, Deriv &deriv)
+{
+	deriv.edge = edge;
+	deriv.rank_x1 = rank_x1;
+	deriv.rank_x2 = rank_x2;
+	deriv.deriv_x1 = NULL;
+	deriv.deriv_x2 = NULL;
+	deriv.score = edge->score;
+	if (edge->child_x1 != NULL)
+	{
+		deriv.deriv_x1 = get_kth_deriv(edge->child_x1,rank_x1);
+		if (deriv.deriv_x1 == NULL)
+			return false;
+		deriv.score += deriv.deriv_x1->score - edge->child_x1->score;
+	}
+	if (edge->child_x2 != NULL)
+	{
+		deriv.deriv_x2 = get_kth_deriv(edge->child_x2,rank_x2);
+		if (deriv.deriv_x2 == NULL)
+			return false;
+		deriv.score += deriv.deriv_x2->score - edge->child_x2->score;
+	}
+	return true;
+}
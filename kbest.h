@@ -0,0 +1,53 @@
+#ifndef KBEST_H
+#define KBEST_H
+#include "stdafx.h"
+#include "cand.h"
+
+const size_t KBEST_DISTINCT_FACTOR = 20;            //为得到n个目标端不同的推导, 最多枚举n*KBEST_DISTINCT_FACTOR个推导
+
+//超图中的一个推导
+//节点为重组后保留在CandBeam中的候选, 节点的入边为该候选本身以及被它重组掉的候选,
+//推导由一条入边以及每个子节点所使用的推导的排名确定
+struct Deriv
+{
+	Cand *edge;                         //推导所使用的入边
+	int rank_x1;                        //x1对应的子节点所使用的推导的排名
+	int rank_x2;                        //x2对应的子节点所使用的推导的排名
+	const Deriv *deriv_x1;              //x1对应的子节点所使用的推导
+	const Deriv *deriv_x2;              //x2对应的子节点所使用的推导
+	double score;                       //推导的总得分
+};
+
+struct DerivCmp
+{
+	bool operator() ( const Deriv &pl, const Deriv &pr )
+	{
+		return pl.score < pr.score;
+	}
+};
+
+//在解码得到的超图上按照Huang and Chiang (2005)中的算法3惰性地抽取k-best推导
+//重组的两个候选语言模型状态和nnjm边界相同, 因此子节点换用其他推导时父节点的得分增量不变, 推导得分可以精确计算
+class KbestExtractor
+{
+	public:
+		const Deriv* get_kth_deriv(Cand *node, size_t k);
+
+	private:
+		struct NodeState
+		{
+			bool is_initialized;
+			deque<Deriv> derivs;                                      //已经确定的前k个推导, 使用deque保证已有元素的地址不变
+			priority_queue<Deriv,vector<Deriv>,DerivCmp> cand_derivs; //候选推导
+			set<pair<Cand*,pair<int,int> > > visited;                 //已经加入过候选推导的(入边,子推导排名)
+			NodeState () : is_initialized(false) {}
+		};
+		void lazy_kth_best(Cand *node, size_t k);
+		void lazy_next(NodeState &state, const Deriv &deriv);
+		bool make_deriv(Cand *edge, int rank_x1, int rank_x2, Deriv &deriv);
+
+	private:
+		unordered_map<Cand*,NodeState> node_states;
+};
+
+#endif
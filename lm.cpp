@@ -1,4 +1,13 @@
 #include "lm.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <thread>
+
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25							//Linux 6.1开始支持, 旧版本的头文件中没有定义
+#endif
 
 struct ID_converter : public lm::EnumerateVocab 
 {
@@ -17,18 +26,184 @@ struct ID_converter : public lm::EnumerateVocab
 	Vocab* tgt_vocab;
 };
 
-LanguageModel::LanguageModel(const string &lm_file, Vocab *tgt_vocab)
+//进程中的一段内存映射, path为映射的文件, 匿名映射时为空
+struct MemRegion
+{
+	uintptr_t beg;
+	uintptr_t end;
+	string path;
+};
+
+//读取/proc/self/maps中的所有内存映射
+static vector<MemRegion> get_mem_regions()
+{
+	vector<MemRegion> regions;
+	ifstream fin("/proc/self/maps");
+	string line;
+	while(getline(fin,line))
+	{
+		MemRegion region;
+		string range,perms,offset,dev,inode;
+		stringstream ss(line);
+		ss>>range>>perms>>offset>>dev>>inode>>region.path;
+		size_t dash = range.find('-');
+		region.beg = stoull(range.substr(0,dash),NULL,16);
+		region.end = stoull(range.substr(dash+1),NULL,16);
+		regions.push_back(region);
+	}
+	return regions;
+}
+
+//读取/proc下status或smaps_rollup文件中以kB为单位的字段, 读取失败时返回0
+static size_t read_proc_kb(const string &proc_file, const string &field)
+{
+	ifstream fin(proc_file.c_str());
+	string line;
+	while(getline(fin,line))
+	{
+		if (line.compare(0,field.size(),field) == 0)
+		{
+			return stoull(line.substr(field.size()));
+		}
+	}
+	return 0;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 按照配置的方式加载KenLM模型, 并建立翻译词表到KenLM词表的映射
+ 2. 入口参数: 语言模型文件, 目标端词表, 参数(LM_LOAD_METHOD, LM_HUGE_PAGES, LM_PREFAULT, LM_REPORT)
+ 3. 出口参数: 无
+ 4. 算法简介: a) LM_LOAD_METHOD决定二进制模型如何进入内存: lazy为直接mmap, 按需缺页;
+                 populate为mmap时预先填充页表; read和parallel-read为分配内存后(并行)读入;
+                 ARPA模型总是解析后存放在匿名内存中, 不受该选项影响
+              b) 对比加载前后的/proc/self/maps, 找出加载过程中新建的匿名映射和模型文件映射
+              c) LM_HUGE_PAGES: 对这些映射建议使用透明大页并尝试立即合并成大页(MADV_COLLAPSE),
+                 减少查询时的TLB缺失; 内核不支持时忽略
+              d) LM_PREFAULT: 对lazy方式映射的模型文件, 在后台线程中逐页访问, 使解码可以立即开始,
+                 同时逐渐消除缺页; 其他方式加载时模型已经常驻内存, 不需要预取
+              e) LM_REPORT: 输出加载时间、内存增量、大页数量以及随机查询的平均延迟
+************************************************************************************* */
+LanguageModel::LanguageModel(const string &lm_file, Vocab *tgt_vocab, const Parameter &para)
 {
 	ID_converter id_converter(&ori_to_kenlm_id,tgt_vocab);
 	Config conf;
 	conf.enumerate_vocab = &id_converter;
+	if (para.LM_LOAD_METHOD == "lazy")
+	{
+		conf.load_method = util::LAZY;
+	}
+	else if (para.LM_LOAD_METHOD == "populate")
+	{
+		conf.load_method = util::POPULATE_OR_READ;
+	}
+	else if (para.LM_LOAD_METHOD == "read")
+	{
+		conf.load_method = util::READ;
+	}
+	else if (para.LM_LOAD_METHOD == "parallel-read")
+	{
+		conf.load_method = util::PARALLEL_READ;
+	}
+	else
+	{
+		cerr<<"unknown lm load method: "<<para.LM_LOAD_METHOD<<endl;
+		exit(EXIT_FAILURE);
+	}
+	vector<MemRegion> old_regions = get_mem_regions();
+	size_t old_rss_kb = read_proc_kb("/proc/self/status","VmRSS:");
+	double load_beg = omp_get_wtime();
 	kenlm = new Model(lm_file.c_str(), conf);
+	double load_time = omp_get_wtime() - load_beg;
+
+	set<pair<uintptr_t,uintptr_t> > old_ranges;
+	for (const auto &region : old_regions)
+	{
+		old_ranges.insert(make_pair(region.beg,region.end));
+	}
+	char lm_path[PATH_MAX];
+	string lm_realpath = realpath(lm_file.c_str(),lm_path) != NULL ? lm_path : lm_file;
+	vector<MemRegion> model_regions;
+	size_t model_region_kb = 0;
+	for (const auto &region : get_mem_regions())
+	{
+		if (old_ranges.count(make_pair(region.beg,region.end)) == 0 && (region.path.empty() || region.path == lm_realpath))
+		{
+			model_regions.push_back(region);
+			model_region_kb += (region.end - region.beg)/1024;
+		}
+	}
+
+	if (para.LM_HUGE_PAGES == true)
+	{
+		for (const auto &region : model_regions)
+		{
+#ifdef MADV_HUGEPAGE
+			madvise((void*)region.beg,region.end-region.beg,MADV_HUGEPAGE);
+#endif
+			madvise((void*)region.beg,region.end-region.beg,MADV_COLLAPSE);
+		}
+	}
+	if (para.LM_PREFAULT == true && conf.load_method == util::LAZY)
+	{
+		vector<MemRegion> file_regions;
+		for (const auto &region : model_regions)
+		{
+			if (region.path == lm_realpath)
+			{
+				madvise((void*)region.beg,region.end-region.beg,MADV_WILLNEED);
+				file_regions.push_back(region);
+			}
+		}
+		thread([file_regions]() {
+			const size_t page_size = sysconf(_SC_PAGESIZE);
+			for (const auto &region : file_regions)
+			{
+				for (uintptr_t addr=region.beg;addr<region.end;addr+=page_size)
+				{
+					*(volatile const char*)addr;
+				}
+			}
+		}).detach();
+	}
+
 	EOS = convert_to_kenlm_id(tgt_vocab->get_id("</s>"));
 	nonterminal_wid = tgt_vocab->get_id("[X][X]");
 	unk_wid = tgt_vocab->get_id("UNK");
 	cerr<<"load language model file "<<lm_file<<" over\n";
+	if (para.LM_REPORT == true)
+	{
+		size_t rss_kb = read_proc_kb("/proc/self/status","VmRSS:");
+		size_t huge_kb = read_proc_kb("/proc/self/smaps_rollup","AnonHugePages:") + read_proc_kb("/proc/self/smaps_rollup","FilePmdMapped:");
+		cerr<<"lm load method: "<<para.LM_LOAD_METHOD<<", huge pages: "<<para.LM_HUGE_PAGES<<", prefault: "<<para.LM_PREFAULT<<endl;
+		cerr<<"lm load time: "<<load_time<<" s, rss increase: "<<(rss_kb-min(rss_kb,old_rss_kb))/1024.0<<" MB, new mappings: "
+			<<model_region_kb/1024.0<<" MB, huge pages in process: "<<huge_kb/1024.0<<" MB"<<endl;
+		cerr<<"lm probe latency: "<<measure_probe_latency()<<" ns"<<endl;
+	}
 };
 
+//用随机的n-gram测量语言模型单次查询的平均延迟(纳秒), 随机访问使结果反映缺页和TLB缺失的代价
+double LanguageModel::measure_probe_latency()
+{
+	const size_t probe_num = 1000000;
+	const lm::WordIndex vocab_bound = kenlm->GetVocabulary().Bound();
+	unsigned int seed = 1;
+	State state = kenlm->BeginSentenceState(), out_state;
+	float total_prob = 0;
+	double beg = omp_get_wtime();
+	for (size_t i=0;i<probe_num;i++)
+	{
+		lm::WordIndex wid = rand_r(&seed) % vocab_bound;
+		total_prob += kenlm->Score(state,wid,out_state);
+		state = out_state;
+	}
+	double elapsed = omp_get_wtime() - beg;
+	if (total_prob > 0)								//避免查询被优化掉
+	{
+		cerr<<total_prob<<endl;
+	}
+	return elapsed*1e9/probe_num;
+}
+
 lm::WordIndex LanguageModel::convert_to_kenlm_id(int wid)
 {
 	if (wid >= ori_to_kenlm_id.size())
@@ -45,6 +220,28 @@ double LanguageModel::cal_increased_lm_score(Cand* cand)
 		const lm::WordIndex ken_lm_id = convert_to_kenlm_id(unk_wid);
 		rule_score.Terminal(ken_lm_id);
 	}
+	else if (!cand->applied_rule.tgt_rule->lm_chunks.empty())     //规则表提供了每段终结符的打分结果, 只需计算跨越非终结符边界的n-gram
+	{
+		const TgtRule *tgt_rule = cand->applied_rule.tgt_rule;
+		size_t chunk_idx = 0;
+		bool in_chunk = false;
+		int nt_num = 1;
+		for (auto wid : tgt_rule->wids)
+		{
+			if (wid == nonterminal_wid)
+			{
+				rule_score.NonTerminal(nt_num == 1 ? cand->child_x1->lm_state : cand->child_x2->lm_state);
+				nt_num++;
+				in_chunk = false;
+			}
+			else if (in_chunk == false)
+			{
+				const RuleLmChunk &chunk = tgt_rule->lm_chunks[chunk_idx++];
+				rule_score.NonTerminal(chunk.state,chunk.prob);
+				in_chunk = true;
+			}
+		}
+	}
 	else
 	{
 		int nt_num = 1;
@@ -74,6 +271,127 @@ double LanguageModel::cal_increased_lm_score(Cand* cand)
 	return increased_lm_score;
 }
 
+/**************************************************************************************
+ 1. 函数功能: 批量计算候选的规则带来的语言模型得分增量, 并设置候选的语言模型状态
+ 2. 入口参数: 已经设置好规则和子候选的候选数组, 候选个数
+ 3. 出口参数: 每个候选的语言模型得分增量
+ 4. 算法简介: 先为所有候选将要查询的n-gram所在的哈希桶发出软件预取, 再依次打分,
+              使各个候选的内存访问相互重叠, 而不是逐个等待内存延迟
+************************************************************************************* */
+void LanguageModel::cal_increased_lm_scores(Cand **cands, size_t cand_num, double *increased_lm_scores)
+{
+	for (size_t i=0;i<cand_num;i++)
+	{
+		prefetch_rule_ngrams(cands[i]);
+	}
+	for (size_t i=0;i<cand_num;i++)
+	{
+		increased_lm_scores[i] = cal_increased_lm_score(cands[i]);
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 对候选打分时将要查询的n-gram发出预取
+ 2. 入口参数: 已经设置好规则和子候选的候选
+ 3. 出口参数: 无
+ 4. 算法简介: 从左到右模拟RuleScore维护的上文(逆序存放, 最近的单词在前):
+              a) 终结符与上文组成的各阶n-gram
+              b) 非终结符左边界的各阶n-gram向左扩展上文后得到的跨边界n-gram,
+                 之后上文变为子候选右边界的单词, 子候选不足n-1个单词时再接上原来的上文;
+                 规则带有预先打分的终结符段时, 每段也按非终结符的方式处理
+              预取只是提示, 模拟与实际查询不完全一致时只影响效果, 不影响结果
+************************************************************************************* */
+void LanguageModel::prefetch_rule_ngrams(Cand *cand)
+{
+	const TgtRule *tgt_rule = cand->applied_rule.tgt_rule;
+	if (tgt_rule == NULL)
+		return;
+	lm::WordIndex context[KENLM_MAX_ORDER],new_context[KENLM_MAX_ORDER];     //与ChartState一样按KENLM_MAX_ORDER分配, 子候选右边界最多有KENLM_MAX_ORDER-1个单词
+	size_t context_len = 0;
+	int nt_num = 1;
+	size_t chunk_idx = 0;
+	bool in_chunk = false;
+	for (auto wid : tgt_rule->wids)
+	{
+		if (wid != nonterminal_wid && in_chunk == true)
+			continue;
+		in_chunk = wid != nonterminal_wid && !tgt_rule->lm_chunks.empty();
+		if (wid == nonterminal_wid || in_chunk == true)         //子候选和预先打分的终结符段都按ChartState扩展
+		{
+			const ChartState &child_state = in_chunk ? tgt_rule->lm_chunks[chunk_idx++].state
+				: nt_num++ == 1 ? cand->child_x1->lm_state : cand->child_x2->lm_state;
+			for (size_t i=0;i<child_state.left.length;i++)
+			{
+				kenlm->PrefetchExtend(child_state.left.pointers[i],i+1,context,context+context_len);
+			}
+			size_t new_len = child_state.right.length;
+			copy(child_state.right.words,child_state.right.words+new_len,new_context);
+			if (!child_state.left.full)
+			{
+				for (size_t i=0;i<context_len && new_len<KENLM_MAX_ORDER-1;i++)
+				{
+					new_context[new_len++] = context[i];
+				}
+			}
+			copy(new_context,new_context+new_len,context);
+			context_len = new_len;
+			continue;
+		}
+		const lm::WordIndex ken_lm_id = convert_to_kenlm_id(wid);
+		kenlm->PrefetchExtend(ken_lm_id,1,context,context+context_len);
+		context_len = min(context_len+1,(size_t)KENLM_MAX_ORDER-1);
+		copy_backward(context,context+context_len-1,context+context_len);
+		context[0] = ken_lm_id;
+	}
+}
+
+//检查规则语言模型文件是否由当前加载的语言模型和目标端词表生成
+bool LanguageModel::check_rule_lm_header(const RuleLmHeader &header)
+{
+	for (size_t wid=0;wid<header.kenlm_ids.size();wid++)
+	{
+		if (header.kenlm_ids[wid] != convert_to_kenlm_id(wid))
+			return false;
+	}
+	return header.lm_fingerprint == cal_lm_fingerprint(*kenlm,header.kenlm_ids);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 用加载的语言模型重新计算抽样规则的每段终结符得分, 与规则语言模型文件中的结果比较
+ 2. 入口参数: 抽样的规则
+ 3. 出口参数: 是否全部一致
+ 4. 算法简介: 与ruletable2bin中的cal_lm_chunks相同, 每段终结符单独用RuleScore打分;
+              指纹只覆盖一元和句首二元得分, 这里检查高阶n-gram是否也来自同一个语言模型
+************************************************************************************* */
+bool LanguageModel::check_rule_lm_samples(const vector<TgtRule> &samples)
+{
+	for (const auto &tgt_rule : samples)
+	{
+		size_t chunk_idx = 0;
+		size_t wid_idx = 0;
+		while (wid_idx < tgt_rule.wids.size())
+		{
+			if (tgt_rule.wids[wid_idx] == nonterminal_wid)
+			{
+				wid_idx++;
+				continue;
+			}
+			ChartState cstate;
+			RuleScore<Model> rule_score(*kenlm,cstate);
+			for (;wid_idx<tgt_rule.wids.size() && tgt_rule.wids[wid_idx]!=nonterminal_wid;wid_idx++)
+			{
+				rule_score.Terminal(convert_to_kenlm_id(tgt_rule.wids[wid_idx]));
+			}
+			if (chunk_idx >= tgt_rule.lm_chunks.size() || fabs(rule_score.Finish()-tgt_rule.lm_chunks[chunk_idx].prob) > 1e-4)
+				return false;
+			chunk_idx++;
+		}
+		if (chunk_idx != tgt_rule.lm_chunks.size())
+			return false;
+	}
+	return true;
+}
+
 double LanguageModel::cal_final_increased_lm_score(Cand* cand) 
 {
 	ChartState cstate;
@@ -83,3 +401,47 @@ double LanguageModel::cal_final_increased_lm_score(Cand* cand)
 	rule_score.Terminal(EOS);
 	return rule_score.Finish();
 }
+
+/**************************************************************************************
+ 1. 函数功能: 估计规则带来的语言模型得分, 用于延迟打分时候选入队的排序
+ 2. 入口参数: 规则目标端, 为NULL时表示OOV候选
+ 3. 出口参数: 语言模型得分的估计值
+ 4. 算法简介: 以非终结符为界将规则目标端切分为若干终结符片段, 对每个片段单独打分,
+              不考虑跨越非终结符边界的ngram; OOV候选与cal_increased_lm_score一致, 只对UNK打分
+************************************************************************************* */
+double LanguageModel::cal_rule_lm_estimate(const TgtRule *tgt_rule)
+{
+	if (tgt_rule == NULL)								//OOV候选
+	{
+		ChartState cstate;
+		RuleScore<Model> rule_score(*kenlm, cstate);
+		rule_score.Terminal(convert_to_kenlm_id(unk_wid));
+		return rule_score.Finish();
+	}
+	vector<vector<lm::WordIndex> > chunks(1);
+	for (auto wid : tgt_rule->wids)
+	{
+		if (wid == nonterminal_wid)
+		{
+			chunks.push_back(vector<lm::WordIndex>());
+		}
+		else
+		{
+			chunks.back().push_back(convert_to_kenlm_id(wid));
+		}
+	}
+	double lm_estimate = 0.0;
+	for (const auto &chunk : chunks)
+	{
+		if (chunk.empty())
+			continue;
+		ChartState cstate;
+		RuleScore<Model> rule_score(*kenlm, cstate);
+		for (auto ken_lm_id : chunk)
+		{
+			rule_score.Terminal(ken_lm_id);
+		}
+		lm_estimate += rule_score.Finish();
+	}
+	return lm_estimate;
+}
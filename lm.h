@@ -9,12 +9,18 @@ using namespace lm::ngram;
 class LanguageModel
 {
 	public:
-		LanguageModel(const string &lm_file, Vocab *tgt_vocab);
+		LanguageModel(const string &lm_file, Vocab *tgt_vocab, const Parameter &para);
 		double cal_increased_lm_score(Cand* cand);
+		void cal_increased_lm_scores(Cand **cands, size_t cand_num, double *increased_lm_scores);
 		double cal_final_increased_lm_score(Cand* cand);
+		double cal_rule_lm_estimate(const TgtRule *tgt_rule);
+		bool check_rule_lm_header(const RuleLmHeader &header);
+		bool check_rule_lm_samples(const vector<TgtRule> &samples);
 
 	private:
 			lm::WordIndex convert_to_kenlm_id(int wid);
+			double measure_probe_latency();
+			void prefetch_rule_ngrams(Cand *cand);
 	private:
 		Model *kenlm;
 		vector<lm::WordIndex> ori_to_kenlm_id;
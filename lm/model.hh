@@ -103,6 +103,16 @@ template <class Search, class VocabularyT> class GenericModel : public base::Mod
       return Search::kDifferentRest ? InternalUnRest(pointers_begin, pointers_end, first_length) : 0.0;
     }
 
+    /* Issue software prefetches for the hash buckets that FullScore or
+     * ExtendLeft would probe when the n-gram identified by (node, length) is
+     * extended by context words in reverse order [context_rbegin, context_rend).
+     * For a single word, node is the word index and length is 1.  Only
+     * hashed search supports this; it is a hint and never changes results.  
+     */
+    void PrefetchExtend(uint64_t node, unsigned char length, const WordIndex *context_rbegin, const WordIndex *context_rend) const {
+      search_.PrefetchExtend(node, length, context_rbegin, context_rend);
+    }
+
   private:
     FullScoreReturn ScoreExceptBackoff(const WordIndex *const context_rbegin, const WordIndex *const context_rend, const WordIndex new_word, State &out_state) const;
 
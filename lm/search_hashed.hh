@@ -125,6 +125,27 @@ template <class Value> class HashedSearch {
       return LongestPointer(found->value.prob);
     }
 
+    // Prefetch the buckets that extending the n-gram (node, length) by context
+    // words [context_rbegin, context_rend) would probe.  
+    void PrefetchExtend(Node node, unsigned char length, const WordIndex *context_rbegin, const WordIndex *context_rend) const {
+      if (length == 1) {
+#ifdef __GNUC__
+        __builtin_prefetch(&unigram_.Lookup(static_cast<WordIndex>(node)));
+#endif
+      } else if (length < Order()) {
+        // ExtendLeft unpacks the starting n-gram before extending it.
+        middle_[length - 2].Prefetch(node);
+      }
+      for (const WordIndex *i = context_rbegin; i != context_rend && length < Order(); ++i, ++length) {
+        node = CombineWordHash(node, *i);
+        if (length + 1 == Order()) {
+          longest_.Prefetch(node);
+        } else {
+          middle_[length - 1].Prefetch(node);
+        }
+      }
+    }
+
     // Generate a node without necessarily checking that it actually exists.
     // Optionally return false if it's know to not exist.
     bool FastMakeNode(const WordIndex *begin, const WordIndex *end, Node &node) const {
@@ -1,4 +1,5 @@
 #include "translator.h"
+#include "transcache.h"
 
 void read_config(Filenames &fns,Parameter &para, Weight &weight, const string &config_file)
 {
@@ -9,6 +10,23 @@ void read_config(Filenames &fns,Parameter &para, Weight &weight, const string &c
 		cerr<<"fail to open config file\n";
 		return;
 	}
+	fns.function_words_file = "data/function-words";
+	para.LAZY_CUBE = false;                                             //可选参数的默认值
+	para.DUMP_HYPERGRAPH = false;
+	para.COARSE_TO_FINE = false;
+	para.COARSE_THRESHOLD = 10.0;
+	para.BEAM_THRESHOLD = 0.0;
+	para.CUBE_EARLY_STOP = 0;
+	para.PHRASE_CACHE_SIZE = 0;
+	para.LM_LOAD_METHOD = "populate";
+	para.LM_HUGE_PAGES = false;
+	para.LM_PREFAULT = false;
+	para.LM_REPORT = false;
+	para.NNJM_PRECOMPUTE = false;
+	para.NNJM_BATCH_SIZE = 0;
+	para.NNJM_CACHE_SIZE = 1000000;
+	para.NNJM_SELF_NORMALIZED = true;
+	para.NNJM_KERNEL = "double";
 	string line;
 	while(getline(fin,line))
 	{
@@ -43,6 +61,11 @@ void read_config(Filenames &fns,Parameter &para, Weight &weight, const string &c
 			getline(fin,line);
 			fns.rule_table_file = line;
 		}
+		else if (line == "[rule-lm-file]")
+		{
+			getline(fin,line);
+			fns.rule_lm_file = line;
+		}
 		else if (line == "[lm-file]")
 		{
 			getline(fin,line);
@@ -53,6 +76,11 @@ void read_config(Filenames &fns,Parameter &para, Weight &weight, const string &c
 			getline(fin,line);
 			fns.nnjm_file = line;
 		}
+		else if (line == "[trans-cache-file]")
+		{
+			getline(fin,line);
+			fns.trans_cache_file = line;
+		}
 		else if (line == "[BEAM-SIZE]")
 		{
 			getline(fin,line);
@@ -98,6 +126,88 @@ void read_config(Filenames &fns,Parameter &para, Weight &weight, const string &c
 			getline(fin,line);
 			para.DROP_OOV = stoi(line);
 		}
+		else if (line == "[LAZY-CUBE]")
+		{
+			getline(fin,line);
+			para.LAZY_CUBE = stoi(line);
+		}
+		else if (line == "[DUMP-HYPERGRAPH]")
+		{
+			getline(fin,line);
+			para.DUMP_HYPERGRAPH = stoi(line);
+		}
+		else if (line == "[COARSE-TO-FINE]")
+		{
+			getline(fin,line);
+			para.COARSE_TO_FINE = stoi(line);
+		}
+		else if (line == "[COARSE-THRESHOLD]")
+		{
+			getline(fin,line);
+			para.COARSE_THRESHOLD = stod(line);
+		}
+		else if (line == "[BEAM-THRESHOLD]")
+		{
+			getline(fin,line);
+			para.BEAM_THRESHOLD = stod(line);
+		}
+		else if (line == "[CUBE-EARLY-STOP]")
+		{
+			getline(fin,line);
+			para.CUBE_EARLY_STOP = stoi(line);
+		}
+		else if (line == "[PHRASE-CACHE-SIZE]")
+		{
+			getline(fin,line);
+			para.PHRASE_CACHE_SIZE = stoi(line);
+		}
+		else if (line == "[LM-LOAD-METHOD]")
+		{
+			getline(fin,line);
+			TrimLine(line);
+			para.LM_LOAD_METHOD = line;
+		}
+		else if (line == "[LM-HUGE-PAGES]")
+		{
+			getline(fin,line);
+			para.LM_HUGE_PAGES = stoi(line);
+		}
+		else if (line == "[LM-PREFAULT]")
+		{
+			getline(fin,line);
+			para.LM_PREFAULT = stoi(line);
+		}
+		else if (line == "[LM-REPORT]")
+		{
+			getline(fin,line);
+			para.LM_REPORT = stoi(line);
+		}
+		else if (line == "[NNJM-PRECOMPUTE]")
+		{
+			getline(fin,line);
+			para.NNJM_PRECOMPUTE = stoi(line);
+		}
+		else if (line == "[NNJM-BATCH-SIZE]")
+		{
+			getline(fin,line);
+			para.NNJM_BATCH_SIZE = stoi(line);
+		}
+		else if (line == "[NNJM-CACHE-SIZE]")
+		{
+			getline(fin,line);
+			para.NNJM_CACHE_SIZE = stoul(line);
+		}
+		else if (line == "[NNJM-SELF-NORMALIZED]")
+		{
+			getline(fin,line);
+			para.NNJM_SELF_NORMALIZED = stoi(line);
+		}
+		else if (line == "[NNJM-KERNEL]")
+		{
+			getline(fin,line);
+			TrimLine(line);
+			para.NNJM_KERNEL = line;
+		}
 		else if (line == "[weight]")
 		{
 			while(getline(fin,line))
@@ -160,22 +270,74 @@ void translate_file(const Models &models, const Parameter &para, const Weight &w
 	if (!fin.is_open() || !fout.is_open() || !fnbest.is_open() || !frules.is_open() )
 	{
 		cerr<<"file open error!\n";
-        exit(0);
+        exit(EXIT_FAILURE);
 	}
+    ofstream fhypergraph;
+    if (para.DUMP_HYPERGRAPH == true)
+    {
+        fhypergraph.open("hypergraph.bin",ios::binary);
+        if (!fhypergraph.is_open())
+        {
+            cerr<<"file open error!\n";
+            exit(EXIT_FAILURE);
+        }
+        fhypergraph.write(HYPERGRAPH_MAGIC,4);
+        int feature_num = PROB_NUM+5;
+        fhypergraph.write((char*)&feature_num,sizeof(int));
+    }
 
 	vector<vector<string> > input_sen_blocks;
     int block_size = para.SEN_THREAD_NUM;
     load_data_into_blocks(input_sen_blocks,fin,block_size);
 
+    if (para.NNJM_KERNEL != "double" && para.NNJM_KERNEL != "float" && para.NNJM_KERNEL != "int8")
+    {
+        cerr<<"unknown nnjm kernel "<<para.NNJM_KERNEL<<", should be double, float or int8\n";
+        exit(EXIT_FAILURE);
+    }
     vector<neuralLM*> nnjm_models;
     nnjm_models.resize(block_size,NULL);
     for (int i=0;i<block_size;i++)
     {
         nnjm_models[i] = new neuralLM();
         nnjm_models[i]->read(fns.nnjm_file);
+        nnjm_models[i]->set_normalization(!para.NNJM_SELF_NORMALIZED);      //可以用nplm/testNormalization检查模型在开发集上的log Z是否接近0
+        if (para.NNJM_BATCH_SIZE > 0)
+        {
+            nnjm_models[i]->set_width(para.NNJM_BATCH_SIZE);
+        }
+    }
+    NnjmCache *nnjm_cache = models.nnjm_cache;
+    if (nnjm_cache != NULL && max(nnjm_models[0]->get_vocabulary().size(),nnjm_models[0]->get_output_vocabulary().size()) > NNJM_KEY_ID_MAX+1)
+    {
+        cerr<<"nnjm cache is disabled since the nnjm vocabulary does not fit in 16-bit keys\n";
+        nnjm_cache = NULL;
+    }
+    FastNnjm *fast_nnjm = NULL;
+    if (para.NNJM_KERNEL == "float" || para.NNJM_KERNEL == "int8")
+    {
+        fast_nnjm = new FastNnjm(*nnjm_models[0],para.NNJM_KERNEL == "int8",FastNnjm::detect_isa());
+        cerr<<"nnjm kernel: "<<para.NNJM_KERNEL<<", "<<FastNnjm::get_isa_name(fast_nnjm->get_isa())<<endl;
+    }
+
+    TransCache *trans_cache = NULL;
+    if (!fns.trans_cache_file.empty())
+    {
+        if (para.DUMP_HYPERGRAPH == true)
+        {
+            cerr<<"translation cache is disabled when dumping hypergraphs\n";
+        }
+        else
+        {
+            trans_cache = new TransCache(fns.trans_cache_file,get_config_hash(fns,para,weight));
+        }
     }
 
     int sen_id = -1;
+    int hypergraph_sen_id = 0;
+    pair<size_t,size_t> recomb_stats = make_pair(0,0);
+    pair<size_t,size_t> lm_memo_stats = make_pair(0,0);
+    vector<CubeStats> cube_stats;
 	int block_num = input_sen_blocks.size();
 	for (size_t i=0;i<block_num;i++)
     {
@@ -183,9 +345,32 @@ void translate_file(const Models &models, const Parameter &para, const Weight &w
         vector<vector<string> > output_paras;
         vector<vector<vector<TuneInfo> > > nbest_tune_info_lists;
         vector<vector<vector<string> > > applied_rules_lists;
+        vector<vector<string> > hypergraph_lists;
+        vector<pair<size_t,size_t> > recomb_stats_list;
+        vector<pair<size_t,size_t> > lm_memo_stats_list;
+        vector<vector<CubeStats> > cube_stats_list;
         output_paras.resize(block_size);
+        recomb_stats_list.resize(block_size);
+        lm_memo_stats_list.resize(block_size);
+        cube_stats_list.resize(block_size);
         nbest_tune_info_lists.resize(block_size);
         applied_rules_lists.resize(block_size);
+        hypergraph_lists.resize(block_size);
+        vector<bool> is_cached(block_size,false);
+        if (trans_cache != NULL)
+        {
+            for (size_t j=0;j<block_size;j++)
+            {
+                TransResult result;
+                if (trans_cache->find(input_sen_blocks.at(i).at(j),result))
+                {
+                    is_cached.at(j) = true;
+                    output_paras.at(j) = result.translations;
+                    nbest_tune_info_lists.at(j) = result.nbest_lists;
+                    applied_rules_lists.at(j) = result.applied_rules_list;
+                }
+            }
+        }
         for (auto line : input_sen_blocks.at(i))
         {
             vector<string> vs;
@@ -198,8 +383,12 @@ void translate_file(const Models &models, const Parameter &para, const Weight &w
 #pragma omp parallel for num_threads(block_size)
         for (size_t j=0;j<block_size;j++)
         {
+            if (is_cached.at(j) == true)
+                continue;
             Models cur_models = models;
             cur_models.nnjm_model = nnjm_models.at(j);
+            cur_models.nnjm_cache = nnjm_cache;
+            cur_models.fast_nnjm = fast_nnjm;
             SentenceTranslator sen_translator(cur_models,para,weight,input_sen_blocks.at(i).at(j));
             output_paras.at(j) = sen_translator.translate_sentence();
             if (para.PRINT_NBEST == true)
@@ -210,6 +399,48 @@ void translate_file(const Models &models, const Parameter &para, const Weight &w
             {
                 applied_rules_lists.at(j) = sen_translator.get_applied_rules();
             }
+            if (para.DUMP_HYPERGRAPH == true)
+            {
+                hypergraph_lists.at(j) = sen_translator.get_hypergraphs();
+            }
+            recomb_stats_list.at(j) = sen_translator.get_recomb_stats();
+            lm_memo_stats_list.at(j) = sen_translator.get_lm_memo_stats();
+            cube_stats_list.at(j) = sen_translator.get_cube_stats();
+        }
+        if (trans_cache != NULL)
+        {
+            for (size_t j=0;j<block_size;j++)
+            {
+                if (is_cached.at(j) == false)
+                {
+                    TransResult result = {output_paras.at(j),nbest_tune_info_lists.at(j),applied_rules_lists.at(j)};
+                    trans_cache->insert(input_sen_blocks.at(i).at(j),result);
+                }
+            }
+        }
+        for (const auto &sen_recomb_stats : recomb_stats_list)
+        {
+            recomb_stats.first += sen_recomb_stats.first;
+            recomb_stats.second += sen_recomb_stats.second;
+        }
+        for (const auto &sen_lm_memo_stats : lm_memo_stats_list)
+        {
+            lm_memo_stats.first += sen_lm_memo_stats.first;
+            lm_memo_stats.second += sen_lm_memo_stats.second;
+        }
+        for (const auto &sen_cube_stats : cube_stats_list)
+        {
+            if (sen_cube_stats.size() > cube_stats.size())
+            {
+                cube_stats.resize(sen_cube_stats.size());
+            }
+            for (size_t span=0;span<sen_cube_stats.size();span++)
+            {
+                cube_stats.at(span).span_num += sen_cube_stats.at(span).span_num;
+                cube_stats.at(span).pop_num += sen_cube_stats.at(span).pop_num;
+                cube_stats.at(span).early_stop_num += sen_cube_stats.at(span).early_stop_num;
+                cube_stats.at(span).threshold_pruned_num += sen_cube_stats.at(span).threshold_pruned_num;
+            }
         }
         for (const auto &output_sens : output_paras)
         {
@@ -252,7 +483,66 @@ void translate_file(const Models &models, const Parameter &para, const Weight &w
                 }
             }
         }
+        if (para.DUMP_HYPERGRAPH == true)
+        {
+            for (const auto &hypergraph_list : hypergraph_lists)
+            {
+                for (const auto &hypergraph : hypergraph_list)
+                {
+                    fhypergraph.write((char*)&hypergraph_sen_id,sizeof(int));
+                    fhypergraph.write(hypergraph.data(),hypergraph.size());
+                    hypergraph_sen_id++;
+                }
+            }
+        }
+    }
+    cerr<<"recombined hypotheses: "<<recomb_stats.first<<", with identical target string: "<<recomb_stats.second
+        <<", merged only by lm and nnjm state: "<<recomb_stats.first-recomb_stats.second<<endl;
+    cerr<<"lm rule score memo hits: "<<lm_memo_stats.first<<" of "<<lm_memo_stats.second<<" queries";
+    if (lm_memo_stats.second > 0)
+    {
+        cerr<<" ("<<100.0*lm_memo_stats.first/lm_memo_stats.second<<"%)";
+    }
+    cerr<<endl;
+    if (para.BEAM_THRESHOLD > 0 || para.CUBE_EARLY_STOP > 0)
+    {
+        cerr<<"span_len\tspans\tavg_pops\tearly_stopped\tthreshold_pruned"<<endl;
+        for (size_t span=0;span<cube_stats.size();span++)       //长度为1的跨度只有短语候选, 没有立方体剪枝
+        {
+            const CubeStats &stats = cube_stats.at(span);
+            if (stats.span_num == 0)
+                continue;
+            cerr<<span+1<<"\t"<<stats.span_num<<"\t"<<(double)stats.pop_num/stats.span_num<<"\t"
+                <<stats.early_stop_num<<"\t"<<stats.threshold_pruned_num<<endl;
+        }
+    }
+    if (trans_cache != NULL)
+    {
+        pair<size_t,size_t> hit_stats = trans_cache->get_hit_stats();
+        cerr<<"translation cache hits: "<<hit_stats.first<<" of "<<hit_stats.second<<" lines"<<endl;
+        delete trans_cache;
     }
+    if (models.phrase_cache != NULL)
+    {
+        pair<size_t,size_t> hit_stats = models.phrase_cache->get_hit_stats();
+        cerr<<"phrase cache hits: "<<hit_stats.first<<" of "<<hit_stats.second<<" queries";
+        if (hit_stats.second > 0)
+        {
+            cerr<<" ("<<100.0*hit_stats.first/hit_stats.second<<"%)";
+        }
+        cerr<<endl;
+    }
+    if (nnjm_cache != NULL)
+    {
+        pair<size_t,size_t> hit_stats = nnjm_cache->get_hit_stats();
+        cerr<<"nnjm cache hits: "<<hit_stats.first<<" of "<<hit_stats.second<<" queries";
+        if (hit_stats.second > 0)
+        {
+            cerr<<" ("<<100.0*hit_stats.first/hit_stats.second<<"%)";
+        }
+        cerr<<endl;
+    }
+    delete fast_nnjm;
 }
 
 int main( int argc, char *argv[])
@@ -268,14 +558,20 @@ int main( int argc, char *argv[])
 
 	Vocab *src_vocab = new Vocab(fns.src_vocab_file);
 	Vocab *tgt_vocab = new Vocab(fns.tgt_vocab_file);
-	RuleTable *ruletable = new RuleTable(para.RULE_NUM_LIMIT,weight,fns.rule_table_file,src_vocab,tgt_vocab);
-	LanguageModel *lm_model = new LanguageModel(fns.lm_file,tgt_vocab);
+	RuleTable *ruletable = new RuleTable(para.RULE_NUM_LIMIT,weight,fns.rule_table_file,fns.rule_lm_file,src_vocab,tgt_vocab);
+	LanguageModel *lm_model = new LanguageModel(fns.lm_file,tgt_vocab,para);
+	if (ruletable->has_lm_chunks() && (!lm_model->check_rule_lm_header(ruletable->get_rule_lm_header())
+		|| !lm_model->check_rule_lm_samples(ruletable->get_rule_lm_samples())))
+	{
+		cerr<<"rule lm file was built with a different language model or target vocabulary!\n";
+		exit(EXIT_FAILURE);
+	}
     set<string> function_words;
-	ifstream fin("data/function-words");
+	ifstream fin(fns.function_words_file.c_str());
 	if (!fin.is_open())
 	{
 		cerr<<"cannot open function words file!\n";
-		exit(0);
+		exit(EXIT_FAILURE);
 	}
     string w;
 	while(fin>>w)
@@ -286,7 +582,9 @@ int main( int argc, char *argv[])
 	b = clock();
 	cerr<<"loading time: "<<double(b-a)/CLOCKS_PER_SEC<<endl;
 
-	Models models = {src_vocab,tgt_vocab,ruletable,lm_model,NULL,&function_words};
+	PhraseCache *phrase_cache = para.PHRASE_CACHE_SIZE > 0 ? new PhraseCache(para.PHRASE_CACHE_SIZE) : NULL;
+	NnjmCache *nnjm_cache = para.NNJM_CACHE_SIZE > 0 ? new NnjmCache(para.NNJM_CACHE_SIZE) : NULL;
+	Models models = {src_vocab,tgt_vocab,ruletable,lm_model,NULL,&function_words,phrase_cache,nnjm_cache,NULL};
 	translate_file(models,para,weight,fns);
 	b = clock();
 	cerr<<"time cost: "<<double(b-a)/CLOCKS_PER_SEC<<endl;
@@ -58,6 +58,9 @@ namespace nplm
 		}
 
 		void set_normalization(bool value) { normalization = value; }
+		bool get_normalization() const { return normalization; }
+		double get_weight() const { return weight; } //factor applied to every log probability (see set_log_base)
+		const model &get_model() const { return nn; } //underlying network, read only
 		void set_log_base(double value) { weight = 1./std::log(value); } //if not loge
 		void set_map_digits(char value) { map_digits = value; }
 
@@ -92,6 +95,7 @@ namespace nplm
 		}
 
 		const vocabulary &get_vocabulary() const { return this->input_vocab; } //get input vocabulary
+		const vocabulary &get_output_vocabulary() const { return this->output_vocab; } //get output vocabulary
 
 		int lookup_input_word(const std::string &word) const //lookup word in the input vocabulary
 		{
@@ -252,6 +256,112 @@ namespace nplm
 			return lookup_ngram(ngram_v.data(), ngram_v.size());
 		}
 
+		// Precompute the first hidden layer contribution of the first n context words of an ngram.
+		// The model must be premultiplied (done by read), so every context word selects one column
+		// of the first hidden layer weights and the contribution is the sum of these columns
+		void precompute_prefix(const int *prefix, int n, Eigen::Matrix<double,Eigen::Dynamic,1> &partial) const
+		{
+			assert (nn.premultiplied);
+			assert (n < ngram_size);
+			std::vector<int> cols(n);
+			for (int i=0; i<n; i++)
+				cols[i] = i*nn.input_vocab_size + prefix[i];
+			partial.setZero(nn.num_hidden);
+			nn.first_hidden_linear.fProp_add_columns(cols.data(), n, partial);
+		}
+
+		// Look up an ngram whose first n context words have been precomputed by precompute_prefix,
+		// suffix holds the remaining ngram_size-n words (the last one is the predicted word).
+		// Only the suffix context words and the layers above the first hidden layer are evaluated,
+		// the result is the same as lookup_ngram on the whole ngram
+		double lookup_ngram_with_prefix(const Eigen::Matrix<double,Eigen::Dynamic,1> &partial, int n, const int *suffix)
+		{
+			assert (nn.premultiplied);
+			int context_size = ngram_size-1;
+			std::vector<int> cols(context_size-n);
+			for (int i=n; i<context_size; i++)
+				cols[i-n] = i*nn.input_vocab_size + suffix[i-n];
+			prop.first_hidden_linear_node.fProp_matrix.col(0) = partial;
+			nn.first_hidden_linear.fProp_add_columns(cols.data(), context_size-n, prop.first_hidden_linear_node.fProp_matrix);
+			prop.fProp_from_first_hidden(1);
+
+			int output = suffix[context_size-n];
+			if (normalization)
+			{
+				Eigen::Matrix<double,Eigen::Dynamic,1> scores(output_vocab.size());
+				prop.output_layer_node.param->fProp(prop.second_hidden_activation_node.fProp_matrix.col(0), scores);
+				double logz = logsum(scores.col(0));
+				return weight * (scores(output, 0) - logz);
+			}
+			return weight * prop.output_layer_node.param->fProp(prop.second_hidden_activation_node.fProp_matrix, output, 0);
+		}
+
+		// Look up n ngrams stored one after another in ngrams (ngram_size words each), width ngrams at a time.
+		// The first hidden layer of each minibatch is built column by column from the premultiplied weights,
+		// so the second hidden layer becomes one matrix-matrix product instead of n matrix-vector products.
+		// If partials is not NULL, partials[j] is the precomputed contribution of the first prefix_len
+		// context words of ngram j (see precompute_prefix) and those words of the ngram are not used
+		void lookup_ngrams(const int *ngrams, int n, double *log_probs,
+				const Eigen::Matrix<double,Eigen::Dynamic,1> *const *partials = NULL, int prefix_len = 0)
+		{
+			assert (nn.premultiplied);
+			int context_size = ngram_size-1;
+			int first = partials == NULL ? 0 : prefix_len;
+			std::vector<int> cols(context_size-first);
+
+			// Make sure that we're single threaded, as in lookup_ngram
+			int save_threads = omp_get_max_threads();
+			omp_set_num_threads(1);
+			int save_eigen_threads = Eigen::nbThreads();
+			Eigen::setNbThreads(1);
+			#ifdef __INTEL_MKL__
+			int save_mkl_threads = mkl_get_max_threads();
+			mkl_set_num_threads(1);
+			#endif
+
+			for (int beg=0; beg<n; beg+=width)
+			{
+				int n_cols = std::min(width, n-beg);
+				for (int j=0; j<n_cols; j++)
+				{
+					const int *ngram_j = ngrams + (beg+j)*ngram_size;
+					for (int i=first; i<context_size; i++)
+						cols[i-first] = i*nn.input_vocab_size + ngram_j[i];
+					if (partials == NULL)
+						prop.first_hidden_linear_node.fProp_matrix.col(j).setZero();
+					else
+						prop.first_hidden_linear_node.fProp_matrix.col(j) = *partials[beg+j];
+					nn.first_hidden_linear.fProp_add_columns(cols.data(), context_size-first, prop.first_hidden_linear_node.fProp_matrix.col(j));
+				}
+				prop.fProp_from_first_hidden(n_cols);
+
+				if (normalization)
+				{
+					Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic> scores(output_vocab.size(), n_cols);
+					prop.output_layer_node.param->fProp(prop.second_hidden_activation_node.fProp_matrix.leftCols(n_cols), scores);
+					for (int j=0; j<n_cols; j++)
+					{
+						int output = ngrams[(beg+j)*ngram_size+context_size];
+						log_probs[beg+j] = weight * (scores(output, j) - logsum(scores.col(j)));
+					}
+				}
+				else
+				{
+					for (int j=0; j<n_cols; j++)
+					{
+						int output = ngrams[(beg+j)*ngram_size+context_size];
+						log_probs[beg+j] = weight * prop.output_layer_node.param->fProp(prop.second_hidden_activation_node.fProp_matrix, output, j);
+					}
+				}
+			}
+
+			#ifdef __INTEL_MKL__
+			mkl_set_num_threads(save_mkl_threads);
+			#endif
+			Eigen::setNbThreads(save_eigen_threads);
+			omp_set_num_threads(save_threads);
+		}
+
 		int get_order() const { return ngram_size; }
 
 		void read(const std::string &filename) //load the input and output vocabulary
@@ -0,0 +1,118 @@
+#include "fastnnjm.h"
+#include "myutils.h"
+#include <chrono>
+#include <random>
+
+//读取数字化的ngram文件, 每行为ngram_size个id, 最后一个为输出词表中的id
+void load_ngrams(const string &ngram_filename, int ngram_size, vector<int> &ngrams)
+{
+	ifstream fin(ngram_filename.c_str());
+	if (!fin.is_open())
+	{
+		cout<<"fail to open "<<ngram_filename<<endl;
+		exit(EXIT_FAILURE);
+	}
+	string line;
+	while(getline(fin,line))
+	{
+		vector<string> vs;
+		Split(vs,line);
+		if (vs.size() != ngram_size)
+			continue;
+		for (auto &s : vs)
+		{
+			ngrams.push_back(stoi(s));
+		}
+	}
+}
+
+//随机生成ngram, 上下文id在输入词表中均匀分布, 最后一个id在输出词表中均匀分布
+void generate_ngrams(const neuralLM &nnjm, int query_num, vector<int> &ngrams)
+{
+	const model &nn = nnjm.get_model();
+	mt19937 gen(1);
+	uniform_int_distribution<int> input_dist(0,nn.input_vocab_size-1);
+	uniform_int_distribution<int> output_dist(0,nn.output_vocab_size-1);
+	for (int i=0;i<query_num;i++)
+	{
+		for (int j=0;j<nn.ngram_size-1;j++)
+		{
+			ngrams.push_back(input_dist(gen));
+		}
+		ngrams.push_back(output_dist(gen));
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 比较neuralLM的double计算与FastNnjm各种精度和指令集的结果及速度
+ 2. 入口参数: nnjm模型文件, 可选的数字化ngram文件(否则随机生成ngram), 查询个数
+ 3. 出口参数: 无
+ 4. 算法简介: 以double计算的得分为参照, 对float32和int8以及CPU支持的每种指令集
+              输出得分的最大和平均绝对误差, 以及每秒查询数
+************************************************************************************* */
+int main(int argc,char* argv[])
+{
+	if(argc < 2)
+	{
+		cout<<"usage: ./nnjmbench nnjm.model [ngrams.txt] [query_num]\n";
+		cout<<"       compare the float32/int8 SIMD nnjm kernels with the double neuralLM path\n";
+		cout<<"       ngrams.txt has one numberized ngram per line, random ngrams are used if it is - or missing\n";
+		return 0;
+	}
+	neuralLM nnjm;
+	nnjm.read(argv[1]);
+	int ngram_size = nnjm.get_order();
+	int query_num = argc > 3 ? stoi(argv[3]) : 100000;
+	vector<int> ngrams;
+	if (argc > 2 && string(argv[2]) != "-")
+	{
+		load_ngrams(argv[2],ngram_size,ngrams);
+	}
+	else
+	{
+		generate_ngrams(nnjm,query_num,ngrams);
+	}
+	query_num = ngrams.size()/ngram_size;
+	if (query_num == 0)
+	{
+		cout<<"no ngram to score\n";
+		return 0;
+	}
+	cout<<"queries: "<<query_num<<", hidden: "<<nnjm.get_model().num_hidden<<", detected isa: "<<FastNnjm::get_isa_name(FastNnjm::detect_isa())<<endl;
+
+	vector<double> ref_scores(query_num);
+	auto beg = chrono::steady_clock::now();
+	for (int i=0;i<query_num;i++)
+	{
+		ref_scores[i] = nnjm.lookup_ngram(ngrams.data()+i*ngram_size,ngram_size);
+	}
+	double ref_seconds = chrono::duration<double>(chrono::steady_clock::now()-beg).count();
+	cout<<"kernel\tisa\tqueries/s\tspeedup\tmax_abs_err\tmean_abs_err\n";
+	cout<<"double\teigen\t"<<query_num/ref_seconds<<"\t1\t0\t0\n";
+
+	for (int use_int8=0;use_int8<2;use_int8++)
+	{
+		for (int isa=NNJM_ISA_SCALAR;isa<=FastNnjm::detect_isa();isa++)
+		{
+			FastNnjm fast_nnjm(nnjm,use_int8,(NnjmIsa)isa);
+			vector<double> scores(query_num);
+			beg = chrono::steady_clock::now();
+			for (int i=0;i<query_num;i++)
+			{
+				scores[i] = fast_nnjm.lookup_ngram(ngrams.data()+i*ngram_size);
+			}
+			double seconds = chrono::duration<double>(chrono::steady_clock::now()-beg).count();
+			double max_err = 0.0;
+			double sum_err = 0.0;
+			for (int i=0;i<query_num;i++)
+			{
+				double err = fabs(scores[i]-ref_scores[i]);
+				max_err = max(max_err,err);
+				sum_err += err;
+			}
+			cout<<(use_int8 ? "int8" : "float")<<"\t"<<FastNnjm::get_isa_name((NnjmIsa)isa)<<"\t"<<query_num/seconds<<"\t"
+				<<ref_seconds/seconds<<"\t"<<max_err<<"\t"<<sum_err/query_num<<endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include "nnjmcache.h"
+#include "util/murmur_hash.hh"
+
+//将NNJM_NGRAM_SIZE个nnjm id压缩为键, id必须在[0,NNJM_KEY_ID_MAX]之间
+void NnjmKey::pack(const int *ngram)
+{
+	for (size_t i=0;i<NNJM_NGRAM_SIZE;i++)
+	{
+		ids[i] = (uint16_t)ngram[i];
+	}
+	for (size_t i=NNJM_NGRAM_SIZE;i<NNJM_KEY_LEN;i++)
+	{
+		ids[i] = 0;
+	}
+}
+
+size_t NnjmKeyHash::operator() (const NnjmKey &key) const
+{
+	return util::MurmurHashNative(key.ids,sizeof(key.ids),0);
+}
+
+size_t NnjmFullKeyHash::operator() (const NnjmFullKey &key) const
+{
+	return util::MurmurHashNative(key.ids,sizeof(key.ids),0);
+}
+
+NnjmCache::NnjmCache(size_t capacity) : shards(SHARD_NUM)
+{
+	Bucket empty_bucket;
+	empty_bucket.used_num = 0;
+	empty_bucket.next_victim = 0;
+	buckets.resize(max(capacity/BUCKET_WAY,(size_t)1),empty_bucket);
+}
+
+//查找ngram的得分, 不存在时返回false
+bool NnjmCache::find(const NnjmKey &key, double &score)
+{
+	size_t bucket_idx = get_bucket_idx(key);
+	Shard &shard = shards[bucket_idx%SHARD_NUM];
+	lock_guard<mutex> guard(shard.lock);
+	shard.query_num++;
+	Bucket &bucket = buckets[bucket_idx];
+	for (size_t i=0;i<bucket.used_num;i++)
+	{
+		if (bucket.entries[i].key == key)
+		{
+			score = bucket.entries[i].score;
+			shard.hit_num++;
+			return true;
+		}
+	}
+	return false;
+}
+
+//加入ngram的得分, 桶已满时替换最早加入的键; 其他线程已经加入时保留原有得分
+void NnjmCache::insert(const NnjmKey &key, double score)
+{
+	size_t bucket_idx = get_bucket_idx(key);
+	Shard &shard = shards[bucket_idx%SHARD_NUM];
+	lock_guard<mutex> guard(shard.lock);
+	Bucket &bucket = buckets[bucket_idx];
+	for (size_t i=0;i<bucket.used_num;i++)
+	{
+		if (bucket.entries[i].key == key)
+			return;
+	}
+	size_t slot;
+	if (bucket.used_num < BUCKET_WAY)
+	{
+		slot = bucket.used_num++;
+	}
+	else
+	{
+		slot = bucket.next_victim;
+		bucket.next_victim = (bucket.next_victim+1)%BUCKET_WAY;
+	}
+	bucket.entries[slot].key = key;
+	bucket.entries[slot].score = score;
+}
+
+pair<size_t,size_t> NnjmCache::get_hit_stats()
+{
+	pair<size_t,size_t> hit_stats = make_pair(0,0);
+	for (auto &shard : shards)
+	{
+		lock_guard<mutex> guard(shard.lock);
+		hit_stats.first += shard.hit_num;
+		hit_stats.second += shard.query_num;
+	}
+	return hit_stats;
+}
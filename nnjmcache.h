@@ -0,0 +1,75 @@
+#ifndef NNJMCACHE_H
+#define NNJMCACHE_H
+#include "stdafx.h"
+#include <mutex>
+
+const size_t NNJM_NGRAM_SIZE = 2*NNJM_SRC_WINDOW+1+NNJM_TGT_WINDOW+1;  //源端窗口, 目标端历史以及当前目标端单词
+const size_t NNJM_KEY_LEN = (NNJM_NGRAM_SIZE+3)/4*4;                    //键按8字节对齐, 多余的位置为0
+const int NNJM_KEY_ID_MAX = 65535;                                      //压缩后每个id占16位
+
+//nnjm ngram压缩后的键, 每个nnjm id占16位
+struct NnjmKey
+{
+	uint16_t ids[NNJM_KEY_LEN];
+	void pack(const int *ngram);
+	bool operator==(const NnjmKey &rhs) const { return memcmp(ids,rhs.ids,sizeof(ids)) == 0; }
+};
+
+struct NnjmKeyHash
+{
+	size_t operator() (const NnjmKey &key) const;
+};
+
+//未压缩的nnjm ngram键, 每个id占32位, 用于批次内去重以及不使用共享缓存时的句子内缓存
+//nnjm词表超过16位时共享缓存被关闭, 此时只能使用这种键
+struct NnjmFullKey
+{
+	int ids[NNJM_NGRAM_SIZE];
+	bool operator==(const NnjmFullKey &rhs) const { return memcmp(ids,rhs.ids,sizeof(ids)) == 0; }
+};
+
+struct NnjmFullKeyHash
+{
+	size_t operator() (const NnjmFullKey &key) const;
+};
+
+//在句子和线程之间共享的nnjm得分缓存, 容量在创建时固定, 不再分配内存
+//表由若干个包含BUCKET_WAY个槽的桶组成, 每个键只能存放在其哈希值对应的桶中;
+//桶按编号分片加锁, 桶满时按先进先出的顺序淘汰桶内最早加入的键
+class NnjmCache
+{
+	public:
+		NnjmCache(size_t capacity);
+		bool find(const NnjmKey &key, double &score);
+		void insert(const NnjmKey &key, double score);
+		pair<size_t,size_t> get_hit_stats();		//返回命中次数和查询次数
+
+	private:
+		static const size_t BUCKET_WAY = 4;
+		static const size_t SHARD_NUM = 64;
+		struct Entry
+		{
+			NnjmKey key;
+			double score;
+		};
+		struct Bucket
+		{
+			Entry entries[BUCKET_WAY];
+			unsigned char used_num;					//已经使用的槽数
+			unsigned char next_victim;				//桶满时下一个被淘汰的槽
+		};
+		struct Shard
+		{
+			mutex lock;
+			size_t hit_num;
+			size_t query_num;
+			Shard () : hit_num(0), query_num(0) {}
+		};
+		size_t get_bucket_idx(const NnjmKey &key) { return NnjmKeyHash()(key)%buckets.size(); }
+
+	private:
+		vector<Bucket> buckets;
+		vector<Shard> shards;
+};
+
+#endif
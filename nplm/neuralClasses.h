@@ -64,6 +64,7 @@ namespace nplm
 
 			int n_inputs () const { return U.cols(); }  //output neuron --> input neuron, columns denote input neuron
 			int n_outputs () const { return U.rows(); } //rows denote output neuron
+			const Matrix<double,Dynamic,Dynamic> &get_U() const { return U; } //weights, read only (used to build inference-only copies)
 
 			template <typename DerivedIn, typename DerivedOut>
 				void fProp(const MatrixBase<DerivedIn> &input, const MatrixBase<DerivedOut> &output) const //weight matrix * input
@@ -81,6 +82,16 @@ namespace nplm
 					uscgemm(1.0, U, input, output.leftCols(input.cols())); //U*input=output
 				}
 
+			// One-hot input given by column indexes: adds the selected columns of U to output in order,
+			// which gives the same result as the sparse version and lets a shared prefix be summed only once
+			template <typename DerivedOut>
+				void fProp_add_columns(const int *cols, int n, const MatrixBase<DerivedOut> &output_const) const
+				{
+					UNCONST(DerivedOut, output_const, output);
+					for (int r=0; r<n; r++)
+						output.col(0) += U.col(cols[r]);
+				}
+
 			template <typename DerivedGOut, typename DerivedGIn>
 				void bProp(const MatrixBase<DerivedGOut> &input, MatrixBase<DerivedGIn> &output) const
 				{
@@ -169,6 +180,8 @@ namespace nplm
 			void read_weights(std::ifstream &W_file) { readMatrix(W_file, *W); } //read weights from file
 			void write_weights(std::ofstream &W_file) { writeMatrix(*W, W_file); } //write weights to file
 			void read_biases(std::ifstream &b_file) { readMatrix(b_file, b); } //read bias from file 
+			const Matrix<double,Dynamic,Dynamic,Eigen::RowMajor> &get_W() const { return *W; } //weights, read only
+			const Matrix<double,Dynamic,1> &get_b() const { return b; } //biases, read only
 			void write_biases(std::ofstream &b_file) { writeMatrix(b, b_file); } //write bias to file
 
 			template <typename Engine>
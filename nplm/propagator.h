@@ -91,6 +91,18 @@ namespace nplm
 				// The propagation stops here because the last layer is very expensive.
 			}
 
+		// Propagate the first n_cols columns from the first hidden linear layer, whose output has already been filled in
+		// (used when the first hidden layer is built from columns, see neuralLM::lookup_ngram_with_prefix and lookup_ngrams)
+		void fProp_from_first_hidden(int n_cols)
+		{
+			first_hidden_activation_node.param->fProp(first_hidden_linear_node.fProp_matrix.leftCols(n_cols),
+					first_hidden_activation_node.fProp_matrix.leftCols(n_cols));
+			second_hidden_linear_node.param->fProp(first_hidden_activation_node.fProp_matrix.leftCols(n_cols),
+					second_hidden_linear_node.fProp_matrix); //writes the first n_cols columns
+			second_hidden_activation_node.param->fProp(second_hidden_linear_node.fProp_matrix.leftCols(n_cols),
+					second_hidden_activation_node.fProp_matrix.leftCols(n_cols));
+		}
+
 		// Dense version (for standard log-likelihood)
 		template <typename DerivedIn, typename DerivedOut>
 			void bProp(const MatrixBase<DerivedIn> &data,
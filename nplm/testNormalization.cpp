@@ -0,0 +1,131 @@
+#include <tclap/CmdLine.h>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/lexical_cast.hpp>
+#include <fstream>
+#include <cmath>
+
+#include "model.h"
+#include "propagator.h"
+#include "neuralClasses.h"
+#include "param.h"
+#include "util.h"
+
+using namespace std;
+using namespace boost;
+using namespace TCLAP;
+using namespace Eigen;
+
+using namespace nplm;
+
+// Checks whether a model is self-normalized, i.e. whether log Z(context) stays close to 0
+// on held-out data, so that decoding may use the unnormalized output score alone.
+int main (int argc, char *argv[]) 
+{
+	param myParam;
+	double threshold;
+
+	try {
+		// program options //
+		CmdLine cmd("Measures the log partition function of a two-layer neural probabilistic language model on held-out data.", ' ' , "0.1");
+
+		ValueArg<int> num_threads("", "num_threads", "Number of threads. Default: maximum.", false, 0, "int", cmd);
+		ValueArg<int> minibatch_size("", "minibatch_size", "Minibatch size. Default: 64.", false, 64, "int", cmd);
+		ValueArg<double> arg_threshold("", "threshold", "Report the fraction of instances with |log Z| above this value. Default: 0.5.", false, 0.5, "double", cmd);
+
+		ValueArg<string> arg_test_file("", "test_file", "Test file (one numberized example per line).", true, "", "string", cmd);
+
+		ValueArg<string> arg_model_file("", "model_file", "Model file.", true, "", "string", cmd);
+
+		cmd.parse(argc, argv);
+
+		myParam.model_file = arg_model_file.getValue();
+		myParam.test_file = arg_test_file.getValue();
+
+		myParam.num_threads  = num_threads.getValue();
+		myParam.minibatch_size = minibatch_size.getValue();
+		threshold = arg_threshold.getValue();
+
+		cerr << "Command line: " << endl;
+		cerr << boost::algorithm::join(vector<string>(argv, argv+argc), " ") << endl;
+
+		const string sep(" Value: ");
+		cerr << arg_model_file.getDescription() << sep << arg_model_file.getValue() << endl;
+		cerr << arg_test_file.getDescription() << sep << arg_test_file.getValue() << endl;
+
+		cerr << num_threads.getDescription() << sep << num_threads.getValue() << endl;
+		cerr << arg_threshold.getDescription() << sep << arg_threshold.getValue() << endl;
+	}
+	catch (TCLAP::ArgException &e)
+	{
+		cerr << "error: " << e.error() <<  " for arg " << e.argId() << endl;
+		exit(1);
+	}
+
+	myParam.num_threads = setup_threads(myParam.num_threads);
+
+	///// Create network and propagator
+
+	model nn;
+	nn.read(myParam.model_file);
+	myParam.ngram_size = nn.ngram_size;
+	propagator prop(nn, myParam.minibatch_size);
+
+	///// Read test data
+
+	vector<int> test_data_flat;
+	readDataFile(myParam.test_file, myParam.ngram_size, test_data_flat);
+	int test_data_size = test_data_flat.size() / myParam.ngram_size;
+	cerr << "Number of test instances: " << test_data_size << endl;
+	if (test_data_size == 0)
+		return 0;
+
+	Map< Matrix<int,Dynamic,Dynamic> > test_data(test_data_flat.data(), myParam.ngram_size, test_data_size);
+
+	///// Compute log Z for every test instance
+
+	int num_batches = (test_data_size-1)/myParam.minibatch_size + 1;
+
+	double sum_logz = 0.0, sum_sq_logz = 0.0, sum_abs_logz = 0.0, max_abs_logz = 0.0;
+	int num_above_threshold = 0;
+	double normalized_log_likelihood = 0.0;      // sum of log p(w|context)
+	double unnormalized_log_likelihood = 0.0;    // sum of the raw output scores used by the self-normalized fast path
+
+	Matrix<double,Dynamic,Dynamic> scores(nn.output_vocab_size, myParam.minibatch_size);
+
+	for (int batch = 0; batch < num_batches; batch++)
+	{
+		int minibatch_start_index = myParam.minibatch_size * batch;
+		int current_minibatch_size = min(myParam.minibatch_size,
+				test_data_size - minibatch_start_index);
+		Matrix<int,Dynamic,Dynamic> minibatch = test_data.middleCols(minibatch_start_index, current_minibatch_size);
+
+		prop.fProp(minibatch.topRows(myParam.ngram_size-1));
+
+		// Do full forward prop through output word embedding layer
+		prop.output_layer_node.param->fProp(prop.second_hidden_activation_node.fProp_matrix, scores);
+
+		for (int i=0; i<current_minibatch_size; i++)
+		{
+			double logz = logsum(scores.col(i));
+			double score = scores(minibatch(myParam.ngram_size-1, i), i);
+			sum_logz += logz;
+			sum_sq_logz += logz*logz;
+			sum_abs_logz += std::abs(logz);
+			max_abs_logz = std::max(max_abs_logz, std::abs(logz));
+			if (std::abs(logz) > threshold)
+				num_above_threshold++;
+			normalized_log_likelihood += score - logz;
+			unnormalized_log_likelihood += score;
+		}
+	}
+
+	double mean_logz = sum_logz / test_data_size;
+	double stddev_logz = std::sqrt(std::max(0.0, sum_sq_logz / test_data_size - mean_logz*mean_logz));
+	cerr << "Mean log Z: " << mean_logz << endl;
+	cerr << "Standard deviation of log Z: " << stddev_logz << endl;
+	cerr << "Mean |log Z|: " << sum_abs_logz / test_data_size << endl;
+	cerr << "Max |log Z|: " << max_abs_logz << endl;
+	cerr << "Fraction with |log Z| > " << threshold << ": " << double(num_above_threshold) / test_data_size << endl;
+	cerr << "Test log-likelihood (normalized): " << normalized_log_likelihood << endl;
+	cerr << "Test log-likelihood (self-normalized): " << unnormalized_log_likelihood << endl;
+}
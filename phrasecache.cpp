@@ -0,0 +1,57 @@
+#include "phrasecache.h"
+#include "util/murmur_hash.hh"
+
+size_t SrcIdsHash::operator() (const vector<int> &src_ids) const
+{
+	return util::MurmurHashNative(src_ids.data(),sizeof(int)*src_ids.size(),0);
+}
+
+PhraseCache::PhraseCache(size_t capacity) : shards(SHARD_NUM)
+{
+	shard_capacity = max(capacity/SHARD_NUM,(size_t)1);
+}
+
+PhraseCache::Shard& PhraseCache::get_shard(const vector<int> &src_ids)
+{
+	return shards[SrcIdsHash()(src_ids)%SHARD_NUM];
+}
+
+//查找源端短语对应的信息, 不存在时返回空指针
+PhraseInfos PhraseCache::find(const vector<int> &src_ids)
+{
+	Shard &shard = get_shard(src_ids);
+	lock_guard<mutex> guard(shard.lock);
+	shard.query_num++;
+	auto it = shard.infos_map.find(src_ids);
+	if (it == shard.infos_map.end())
+		return PhraseInfos();
+	shard.hit_num++;
+	return it->second;
+}
+
+//加入源端短语对应的信息, 分片已满时淘汰最早加入的短语; 其他线程已经加入时保留原有信息
+void PhraseCache::insert(const vector<int> &src_ids, const PhraseInfos &infos)
+{
+	Shard &shard = get_shard(src_ids);
+	lock_guard<mutex> guard(shard.lock);
+	if (shard.infos_map.insert(make_pair(src_ids,infos)).second == false)
+		return;
+	shard.insert_order.push_back(src_ids);
+	if (shard.insert_order.size() > shard_capacity)
+	{
+		shard.infos_map.erase(shard.insert_order.front());
+		shard.insert_order.pop_front();
+	}
+}
+
+pair<size_t,size_t> PhraseCache::get_hit_stats()
+{
+	pair<size_t,size_t> hit_stats = make_pair(0,0);
+	for (auto &shard : shards)
+	{
+		lock_guard<mutex> guard(shard.lock);
+		hit_stats.first += shard.hit_num;
+		hit_stats.second += shard.query_num;
+	}
+	return hit_stats;
+}
@@ -0,0 +1,52 @@
+#ifndef PHRASECACHE_H
+#define PHRASECACHE_H
+#include "stdafx.h"
+#include "cand.h"
+#include <memory>
+#include <mutex>
+#include <deque>
+
+//短语候选中与上下文无关的信息, 与源端短语匹配到的每个目标端一一对应
+struct PhraseInfo
+{
+	double lm_prob;						//目标端在规则内部的语言模型得分
+	lm::ngram::ChartState lm_state;		//目标端的语言模型状态
+	vector<int> src_offsets;			//目标端每个单词对应的源端位置相对于短语起始位置的偏移(已处理对空的单词)
+};
+
+typedef shared_ptr<const vector<PhraseInfo> > PhraseInfos;
+
+struct SrcIdsHash
+{
+	size_t operator() (const vector<int> &src_ids) const;
+};
+
+//在句子和线程之间共享的短语候选缓存, 以源端短语的id序列为键
+//按键的哈希值分片加锁, 每个分片写满后按先进先出的顺序淘汰
+class PhraseCache
+{
+	public:
+		PhraseCache(size_t capacity);
+		PhraseInfos find(const vector<int> &src_ids);
+		void insert(const vector<int> &src_ids, const PhraseInfos &infos);
+		pair<size_t,size_t> get_hit_stats();		//返回命中次数和查询次数
+
+	private:
+		struct Shard
+		{
+			mutex lock;
+			unordered_map<vector<int>,PhraseInfos,SrcIdsHash> infos_map;
+			deque<vector<int> > insert_order;
+			size_t hit_num;
+			size_t query_num;
+			Shard () : hit_num(0), query_num(0) {}
+		};
+		Shard& get_shard(const vector<int> &src_ids);
+
+	private:
+		static const size_t SHARD_NUM = 64;
+		vector<Shard> shards;
+		size_t shard_capacity;
+};
+
+#endif
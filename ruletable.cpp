@@ -1,6 +1,6 @@
 #include "ruletable.h"
 
-void RuleTable::load_rule_table(const string &rule_table_file)
+void RuleTable::load_rule_table(const string &rule_table_file, const string &rule_lm_file)
 {
 	ifstream fin(rule_table_file.c_str(),ios::binary);
 	if (!fin.is_open())
@@ -8,7 +8,20 @@ void RuleTable::load_rule_table(const string &rule_table_file)
 		cerr<<"cannot open rule table file!\n";
 		return;
 	}
+	ifstream flm;                                   //规则语言模型文件的记录与规则表一一对应
+	if (!rule_lm_file.empty())
+	{
+		flm.open(rule_lm_file.c_str(),ios::binary);
+		if (!flm.is_open())
+		{
+			cerr<<"cannot open rule lm file!\n";
+			exit(EXIT_FAILURE);
+		}
+		load_rule_lm_header(flm);
+		has_rule_lm = true;
+	}
 	short int src_rule_len=0;
+	size_t rule_num = 0;
 	while(fin.read((char*)&src_rule_len,sizeof(short int)))
 	{
 		vector<int> src_wids;
@@ -53,6 +66,15 @@ void RuleTable::load_rule_table(const string &rule_table_file)
         {
             tgt_rule.word_num -= 2;
         }
+		if (has_rule_lm == true)
+		{
+			load_lm_chunks(flm,tgt_rule);
+			if (rule_num%RULE_LM_SAMPLE_STEP == 0 && !tgt_rule.lm_chunks.empty())
+			{
+				rule_lm_samples.push_back(tgt_rule);
+			}
+		}
+		rule_num++;
 		add_rule_to_trie(src_wids,tgt_rule);
 
         /*
@@ -72,9 +94,65 @@ void RuleTable::load_rule_table(const string &rule_table_file)
         */
 	}
 	fin.close();
+	if (has_rule_lm == true)
+	{
+		if (flm.peek() != EOF)
+		{
+			cerr<<"rule lm file does not match the rule table!\n";
+			exit(EXIT_FAILURE);
+		}
+		flm.close();
+	}
+	sort_tgt_rules(root);
 	cerr<<"load rule table file "<<rule_table_file<<" over\n";
 }
 
+//读取规则语言模型文件的文件头, 格式见ruletable2bin.cpp中的write_rule_lm_header
+void RuleTable::load_rule_lm_header(ifstream &flm)
+{
+	char magic[4];
+	int state_size = 0;
+	int vocab_size = 0;
+	flm.read(magic,4);
+	flm.read((char*)&state_size,sizeof(int));
+	if (!flm || memcmp(magic,"RLM2",4) != 0 || state_size != sizeof(lm::ngram::ChartState))
+	{
+		cerr<<"wrong rule lm file format, or it was built with a different KENLM_MAX_ORDER or an older ruletable2bin!\n";
+		exit(EXIT_FAILURE);
+	}
+	flm.read((char*)&vocab_size,sizeof(int));
+	rule_lm_header.kenlm_ids.resize(vocab_size);
+	flm.read((char*)&rule_lm_header.kenlm_ids[0],sizeof(uint32_t)*vocab_size);
+	flm.read((char*)&rule_lm_header.lm_fingerprint,sizeof(uint64_t));
+}
+
+//读取一条规则的语言模型记录: short段数, 每段为float得分和ChartState
+void RuleTable::load_lm_chunks(ifstream &flm, TgtRule &tgt_rule)
+{
+	short int chunk_num = 0;
+	if (!flm.read((char*)&chunk_num,sizeof(short int)))
+	{
+		cerr<<"rule lm file does not match the rule table!\n";
+		exit(EXIT_FAILURE);
+	}
+	tgt_rule.lm_chunks.resize(chunk_num);
+	for (auto &chunk : tgt_rule.lm_chunks)
+	{
+		flm.read((char*)&chunk.prob,sizeof(float));
+		flm.read((char*)&chunk.state,sizeof(lm::ngram::ChartState));
+	}
+}
+
+//将每个规则源端对应的所有目标端按得分从高到低排序, 解码时目标端的排名即为立方体剪枝中规则维度的下标
+void RuleTable::sort_tgt_rules(RuleTrieNode *node)
+{
+	sort(node->tgt_rules.begin(),node->tgt_rules.end(),[](const TgtRule &a, const TgtRule &b){return b < a;});
+	for (auto &kvp : node->id2subtrie_map)
+	{
+		sort_tgt_rules(kvp.second);
+	}
+}
+
 vector<vector<TgtRule>* > RuleTable::find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos)
 {
 	vector<vector<TgtRule>* > matched_rules_for_prefixes;
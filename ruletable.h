@@ -1,5 +1,40 @@
 #include "stdafx.h"
 #include "vocab.h"
+#include "lm/state.hh"
+#include "lm/model.hh"
+#include "util/murmur_hash.hh"
+
+//规则目标端一段连续终结符的语言模型打分结果, 由ruletable2bin预先计算
+struct RuleLmChunk
+{
+	float prob;                                 // 不依赖上文的语言模型得分
+	lm::ngram::ChartState state;                // 该段终结符的语言模型状态
+};
+
+const size_t RULE_LM_SAMPLE_STEP = 1000;        //每隔这么多条规则抽取一条, 检查规则语言模型文件中的打分结果
+
+//规则语言模型文件(prob.lm.bin)的文件头, 用来检查与解码时加载的语言模型是否一致
+struct RuleLmHeader
+{
+	vector<uint32_t> kenlm_ids;                 // 目标端每个单词的KenLM id
+	uint64_t lm_fingerprint;                    // 生成时所用语言模型的指纹, 见cal_lm_fingerprint
+};
+
+//语言模型的指纹: 模型的阶数, 以及目标端每个单词的一元得分和在句首的得分(按目标端词表顺序)的哈希值,
+//与文件的格式、大小和修改时间无关, 由ruletable2bin写入规则语言模型文件, 解码时与加载的语言模型比较
+inline uint64_t cal_lm_fingerprint(const lm::ngram::Model &model, const vector<uint32_t> &kenlm_ids)
+{
+	vector<float> values;
+	values.reserve(2*kenlm_ids.size()+1);
+	values.push_back(model.Order());
+	lm::ngram::State out_state;
+	for (auto kenlm_id : kenlm_ids)
+	{
+		values.push_back(model.FullScore(model.NullContextState(),kenlm_id,out_state).prob);
+		values.push_back(model.FullScore(model.BeginSentenceState(),kenlm_id,out_state).prob);
+	}
+	return util::MurmurHash64A(values.data(),values.size()*sizeof(float));
+}
 
 struct TgtRule
 {
@@ -10,6 +45,7 @@ struct TgtRule
     vector<int> tgt_to_src_idx;                 // 规则目标端每个单词在规则源端对应的位置
 	double score;                               // 规则打分, 即翻译概率与词汇权重的加权
 	vector<double> probs;                       // 翻译概率和词汇权重
+	vector<RuleLmChunk> lm_chunks;              // 目标端每段连续终结符的语言模型打分结果, 未提供规则语言模型文件时为空
 };
 
 struct RuleTrieNode 
@@ -21,20 +57,27 @@ struct RuleTrieNode
 class RuleTable
 {
 	public:
-		RuleTable(const size_t size_limit,const Weight &i_weight,const string &rule_table_file,Vocab *i_src_vocab, Vocab *i_tgt_vocab)
+		RuleTable(const size_t size_limit,const Weight &i_weight,const string &rule_table_file,const string &rule_lm_file,Vocab *i_src_vocab, Vocab *i_tgt_vocab)
 		{
             src_vocab = i_src_vocab;
             tgt_vocab = i_tgt_vocab;
 			RULE_NUM_LIMIT=size_limit;
 			weight=i_weight;
 			root=new RuleTrieNode;
-			load_rule_table(rule_table_file);
+			has_rule_lm = false;
+			load_rule_table(rule_table_file,rule_lm_file);
 		};
 		vector<vector<TgtRule>* > find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos);
+		bool has_lm_chunks() { return has_rule_lm; }
+		const RuleLmHeader& get_rule_lm_header() { return rule_lm_header; }
+		const vector<TgtRule>& get_rule_lm_samples() { return rule_lm_samples; }
 
 	private:
-		void load_rule_table(const string &rule_table_file);
+		void load_rule_table(const string &rule_table_file, const string &rule_lm_file);
+		void load_rule_lm_header(ifstream &flm);
+		void load_lm_chunks(ifstream &flm, TgtRule &tgt_rule);
 		void add_rule_to_trie(const vector<int> &src_wids, const TgtRule &tgt_rule);
+		void sort_tgt_rules(RuleTrieNode *node);
 
 	private:
 		int RULE_NUM_LIMIT;                      // 每个规则源端最多加载的目标端个数 
@@ -42,4 +85,7 @@ class RuleTable
 		Weight weight;                           // 特征权重
         Vocab *src_vocab;
         Vocab *tgt_vocab;
+		bool has_rule_lm;                        // 是否加载了每条规则预先计算的语言模型打分结果
+		RuleLmHeader rule_lm_header;
+		vector<TgtRule> rule_lm_samples;         // 均匀抽取的带语言模型打分结果的规则, 解码前用加载的语言模型重新打分检查
 };
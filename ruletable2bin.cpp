@@ -1,5 +1,89 @@
 #include "myutils.h"
+#include "ruletable.h"
+#include "lm/model.hh"
+#include "lm/left.hh"
 const int LEN = 4096;
+const char RULE_LM_MAGIC[] = "RLM2";
+
+//规则目标端一段连续终结符的语言模型打分结果
+struct LmChunk
+{
+    float prob;
+    lm::ngram::ChartState state;
+};
+
+/**************************************************************************************
+ 1. 函数功能: 计算规则目标端每段连续终结符的语言模型得分和状态
+ 2. 入口参数: 语言模型, 规则目标端的单词序列
+ 3. 出口参数: 每段连续终结符的打分结果, 按在目标端出现的顺序排列
+ 4. 算法简介: 每段终结符单独用RuleScore打分, 得分只包含不依赖上文的部分(段首单词使用rest cost),
+              解码时把每段当作非终结符接入RuleScore, 只需补充跨越非终结符边界的n-gram
+************************************************************************************* */
+vector<LmChunk> cal_lm_chunks(const lm::ngram::Model &model, const vector<string> &en_word_vec)
+{
+    vector<LmChunk> chunks;
+    LmChunk chunk;
+    lm::ngram::RuleScore<lm::ngram::Model> rule_score(model,chunk.state);
+    bool in_chunk = false;
+    for (size_t j=0;j<=en_word_vec.size();j++)
+    {
+        if (j == en_word_vec.size() || en_word_vec.at(j) == "[X][X]")
+        {
+            if (in_chunk == true)
+            {
+                chunk.prob = rule_score.Finish();
+                chunk.state.ZeroRemaining();
+                chunks.push_back(chunk);
+                in_chunk = false;
+            }
+            continue;
+        }
+        if (in_chunk == false)
+        {
+            rule_score.Reset(chunk.state);
+            in_chunk = true;
+        }
+        rule_score.Terminal(model.GetVocabulary().Index(en_word_vec.at(j)));
+    }
+    return chunks;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 写入规则语言模型文件的文件头
+ 2. 入口参数: 输出文件, 语言模型, 目标端词表
+ 3. 出口参数: 无
+ 4. 算法简介: 文件头依次为4字节RULE_LM_MAGIC, int ChartState的字节数, int目标端词表大小,
+              目标端每个单词的KenLM id(uint32), uint64语言模型的指纹(见ruletable.h中的cal_lm_fingerprint);
+              解码器据此检查规则表、词表和加载的语言模型是否一致
+************************************************************************************* */
+void write_rule_lm_header(ofstream &fout, const lm::ngram::Model &model, const unordered_map<string,int> &en_vocab)
+{
+    fout.write(RULE_LM_MAGIC,4);
+    int state_size = sizeof(lm::ngram::ChartState);
+    fout.write((char*)&state_size,sizeof(int));
+    int vocab_size = en_vocab.size();
+    fout.write((char*)&vocab_size,sizeof(int));
+    vector<uint32_t> kenlm_ids(vocab_size,0);
+    for (const auto &kvp : en_vocab)
+    {
+        kenlm_ids.at(kvp.second) = model.GetVocabulary().Index(kvp.first);
+    }
+    fout.write((char*)&kenlm_ids[0],sizeof(uint32_t)*vocab_size);
+    uint64_t lm_fingerprint = cal_lm_fingerprint(model,kenlm_ids);
+    fout.write((char*)&lm_fingerprint,sizeof(uint64_t));
+}
+
+//写入一条规则的语言模型记录: short段数, 每段为float得分和ChartState
+void write_lm_chunks(ofstream &fout, const vector<LmChunk> &chunks)
+{
+    short int chunk_num = chunks.size();
+    fout.write((char*)&chunk_num,sizeof(short int));
+    for (const auto &chunk : chunks)
+    {
+        fout.write((char*)&chunk.prob,sizeof(float));
+        fout.write((char*)&chunk.state,sizeof(lm::ngram::ChartState));
+    }
+}
 
 bool load_block(vector<string> &data_block, gzFile &gzfp,int block_size)
 {
@@ -30,7 +114,7 @@ void extract_vocab(string rule_filename, unordered_map<string,int> &ch_vocab, un
 	if (!gzfp)
 	{
 		cout<<"fail to open "<<rule_filename<<endl;
-		exit(0);
+		exit(EXIT_FAILURE);
 	}
 	char buf[LEN];
 	while( gzgets(gzfp,buf,LEN) != Z_NULL)
@@ -96,18 +180,32 @@ void extract_vocab(string rule_filename, unordered_map<string,int> &ch_vocab, un
 	f_en_vocab.close();
 }
 
-void ruletable2bin(string rule_filename)
+void ruletable2bin(string rule_filename, string lm_filename)
 {
 	unordered_map <string,int> ch_vocab;
 	unordered_map <string,int> en_vocab;
     extract_vocab(rule_filename,ch_vocab,en_vocab);
 
+    lm::ngram::Model *lm_model = NULL;              //提供语言模型时, 同时输出每条规则的语言模型打分结果
+    ofstream flm;
+    if (!lm_filename.empty())
+    {
+        lm_model = new lm::ngram::Model(lm_filename.c_str());
+        flm.open("prob.lm.bin",ios::binary);
+        if (!flm.is_open())
+        {
+            cout<<"fail open rule lm file to write!\n";
+            exit(EXIT_FAILURE);
+        }
+        write_rule_lm_header(flm,*lm_model,en_vocab);
+    }
+
 	ofstream fout;
 	fout.open("prob.bin",ios::binary);
 	if (!fout.is_open())
 	{
 		cout<<"fail open model file to write!\n";
-		exit(0);
+		exit(EXIT_FAILURE);
 	}
 
 	gzFile gzfp = gzopen(rule_filename.c_str(),"r");
@@ -120,6 +218,7 @@ void ruletable2bin(string rule_filename)
         vector<vector<int> > en_to_ch_idx_list(block_size,vector<int>());
         vector<vector<double> > prob_vec_list(block_size,vector<double>());
         vector<short int> rule_type_list(block_size,0);
+        vector<vector<LmChunk> > lm_chunks_list(block_size,vector<LmChunk>());
 
 #pragma omp parallel for num_threads(16)
         for (int i=0;i<data_block.size();i++)
@@ -222,6 +321,10 @@ void ruletable2bin(string rule_filename)
                 en_to_ch_idx.at(j) = (*min_element(ch_idx_vec.begin(),ch_idx_vec.end()) + *max_element(ch_idx_vec.begin(),ch_idx_vec.end()))/2;
             }
 
+            if (lm_model != NULL)
+            {
+                lm_chunks_list.at(i) = cal_lm_chunks(*lm_model,en_word_vec);
+            }
             ch_id_vec_list.at(i) = ch_id_vec;
             en_id_vec_list.at(i) = en_id_vec;
             en_id_vec_list.at(i) = en_id_vec;
@@ -242,6 +345,10 @@ void ruletable2bin(string rule_filename)
             fout.write((char*)&en_to_ch_idx_list[i][0],sizeof(int)*en_rule_len);
             fout.write((char*)&prob_vec_list[i][0],sizeof(double)*prob_vec_list[i].size());
             fout.write((char*)&rule_type_list[i],sizeof(short int));
+            if (lm_model != NULL)
+            {
+                write_lm_chunks(flm,lm_chunks_list[i]);
+            }
         }
     }
 	gzclose(gzfp);
@@ -261,17 +368,25 @@ void ruletable2bin(string rule_filename)
 	fout.write((char*)&prob_vec[0],sizeof(double)*prob_vec.size());
 	fout.write((char*)&rule_type,sizeof(short int));
 	fout.close();
+    if (lm_model != NULL)
+    {
+        write_lm_chunks(flm,vector<LmChunk>());                     //glue规则没有终结符
+        flm.close();
+        delete lm_model;
+    }
 }
 
 int main(int argc,char* argv[])
 {
     if(argc == 1)
     {
-		cout<<"usage: ./ruletable2bin ruletable.gz\n";
+		cout<<"usage: ./ruletable2bin ruletable.gz [lm-file]\n";
+		cout<<"       with lm-file, also write prob.lm.bin with the rule-internal lm scores and states\n";
 		return 0;
     }
     string rule_filename(argv[1]);
-    ruletable2bin(rule_filename);
+    string lm_filename = argc > 2 ? argv[2] : "";
+    ruletable2bin(rule_filename,lm_filename);
 	return 0;
 }
 
@@ -9,6 +9,7 @@
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <algorithm>
 #include <numeric>
@@ -31,9 +32,12 @@
 using namespace std;
 
 const size_t LM_ORDER = 5;
+const size_t LM_PREFETCH_BATCH = 16;				//批量语言模型打分时一次预取的候选数, 过大时预取的数据会在使用前被换出缓存
 const size_t PROB_NUM=4;
 const size_t RULE_LEN_MAX=10;
 const size_t SPAN_LEN_MAX=20;
+const size_t NNJM_SRC_WINDOW=5;						//nnjm源端窗口为当前位置左右各NNJM_SRC_WINDOW个单词
+const size_t NNJM_TGT_WINDOW=3;						//nnjm目标端历史的单词数
 const double LogP_PseudoZero = -99.0;
 const double LogP_One = 0.0;
 
@@ -44,6 +48,16 @@ struct TuneInfo
 	double total_score;
 };
 
+//每种跨度长度的立方体剪枝统计信息
+struct CubeStats
+{
+	size_t span_num;					//该长度的跨度数
+	size_t pop_num;						//从优先级队列中取出的候选数
+	size_t early_stop_num;				//提前结束立方体剪枝的跨度数
+	size_t threshold_pruned_num;		//被相对阈值剪掉的候选数
+	CubeStats () : span_num(0), pop_num(0), early_stop_num(0), threshold_pruned_num(0) {}
+};
+
 struct Filenames
 {
 	string input_file;
@@ -54,6 +68,9 @@ struct Filenames
 	string rule_table_file;
 	string lm_file;
 	string nnjm_file;
+	string rule_lm_file;				//ruletable2bin生成的规则内部语言模型打分文件, 为空时不使用
+	string trans_cache_file;			//重复输入行的翻译缓存文件, 为空时不使用
+	string function_words_file;			//虚词列表文件, 固定为data/function-words
 };
 
 struct Parameter
@@ -67,6 +84,22 @@ struct Parameter
 	bool PRINT_NBEST;
 	bool DUMP_RULE;						//是否输出所使用的规则
 	bool DROP_OOV;						//是否在译文中显示OOV
+	bool LAZY_CUBE;						//立方体剪枝时是否延迟计算语言模型和nnjm得分, 直到候选出队
+	bool DUMP_HYPERGRAPH;				//是否以二进制格式输出每个句子剪枝后的超图
+	bool COARSE_TO_FINE;				//是否先用粗粒度模型剪枝规则, 再用完整模型解码
+	double COARSE_THRESHOLD;			//粗粒度剪枝的阈值, 最大边际得分比最好推导低出该值的规则被剪掉
+	double BEAM_THRESHOLD;				//每个span的相对阈值, 得分比最好候选低出该值的候选被剪掉, 0表示不使用
+	size_t CUBE_EARLY_STOP;				//连续取出这么多个无法进入列表的候选时提前结束立方体剪枝, 0表示不使用
+	size_t PHRASE_CACHE_SIZE;			//句子之间共享的短语候选缓存最多保存的源端短语数, 0表示不使用
+	string LM_LOAD_METHOD;				//二进制语言模型的加载方式: lazy, populate, read, parallel-read
+	bool LM_HUGE_PAGES;					//是否对语言模型所在内存使用透明大页
+	bool LM_PREFAULT;					//lazy加载时是否在后台线程中预先访问语言模型的所有页
+	bool LM_REPORT;						//是否输出语言模型加载的内存和查询延迟统计
+	bool NNJM_PRECOMPUTE;				//是否为每个源端位置预先计算源端窗口对nnjm第一隐层的贡献
+	int NNJM_BATCH_SIZE;				//一批候选的nnjm查询每次最多一起计算的ngram数, 0表示逐个查询
+	size_t NNJM_CACHE_SIZE;				//句子之间共享的nnjm得分缓存最多保存的ngram数, 0表示不使用
+	string NNJM_KERNEL;					//nnjm的计算方式: double(neuralLM), float, int8(后两者使用SIMD推理核函数)
+	bool NNJM_SELF_NORMALIZED;			//nnjm是否为自归一化模型(如NCE训练), 是则只计算输出层中当前单词一行的得分, 否则计算完整的softmax
 };
 
 struct Weight
@@ -0,0 +1,354 @@
+#include "transcache.h"
+#include "myutils.h"
+#include "util/murmur_hash.hh"
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const char TRANS_CACHE_MAGIC[] = "TMC1";
+const size_t TRANS_CACHE_HEADER_SIZE = 4;
+const size_t TRANS_CACHE_MAP_MIN = 1<<24;			//映射的最小长度, 之后每次扩大为文件长度的两倍
+
+//将序列化时使用的基本类型追加到字符串末尾
+template <class T>
+static void append_value(string &out, const T &value)
+{
+	out.append((const char*)&value,sizeof(T));
+}
+
+static void append_string(string &out, const string &s)
+{
+	append_value(out,(uint32_t)s.size());
+	out += s;
+}
+
+//从序列化的数据中依次读出基本类型
+class ValueReader
+{
+	public:
+		ValueReader(const char *i_data) : data(i_data) {}
+		template <class T>
+		T read() { T value; memcpy(&value,data,sizeof(T)); data += sizeof(T); return value; }
+		string read_string() { uint32_t len = read<uint32_t>(); string s(data,len); data += len; return s; }
+	private:
+		const char *data;
+};
+
+//将文件名以及文件的长度和修改时间加入配置, 模型文件被原地重建后配置哈希值随之改变;
+//文件名为空(不使用该文件)或者无法访问时长度和修改时间记为-1
+static void append_file_stamp(string &out, const string &file)
+{
+	append_string(out,file);
+	struct stat st;
+	if (file.empty() || stat(file.c_str(),&st) == -1)
+	{
+		for (int i=0;i<3;i++)
+		{
+			append_value(out,(int64_t)-1);
+		}
+		return;
+	}
+	append_value(out,(int64_t)st.st_size);
+	append_value(out,(int64_t)st.st_mtim.tv_sec);
+	append_value(out,(int64_t)st.st_mtim.tv_nsec);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 计算影响翻译结果的所有输入的哈希值
+ 2. 入口参数: 文件名, 参数, 特征权重
+ 3. 出口参数: 配置的哈希值
+ 4. 算法简介: 包括每个模型文件(词表, 规则表, 规则语言模型, 语言模型, nnjm, 虚词列表)的
+              文件名、长度和修改时间, 以及所有会改变译文、n-best或输出规则的参数和权重;
+              只影响速度的参数(线程数, 各种缓存的大小, 语言模型的加载方式等)不计入
+************************************************************************************* */
+uint64_t get_config_hash(const Filenames &fns, const Parameter &para, const Weight &weight)
+{
+	string config;
+	for (auto &fn : {fns.src_vocab_file,fns.tgt_vocab_file,fns.rule_table_file,fns.lm_file,fns.nnjm_file,fns.rule_lm_file,fns.function_words_file})
+	{
+		append_file_stamp(config,fn);
+	}
+	for (auto v : {para.BEAM_SIZE,para.CUBE_SIZE,para.NBEST_NUM,para.RULE_NUM_LIMIT})
+	{
+		append_value(config,(int64_t)v);
+	}
+	for (auto v : {para.PRINT_NBEST,para.DUMP_RULE,para.DROP_OOV,para.LAZY_CUBE,para.COARSE_TO_FINE,para.NNJM_SELF_NORMALIZED,para.NNJM_PRECOMPUTE})
+	{
+		append_value(config,(char)v);
+	}
+	append_value(config,para.COARSE_THRESHOLD);
+	append_value(config,para.BEAM_THRESHOLD);
+	append_value(config,(int64_t)para.CUBE_EARLY_STOP);
+	append_value(config,(int64_t)para.NNJM_BATCH_SIZE);					//预先计算和批量计算改变nnjm得分的浮点求和顺序
+	append_string(config,para.NNJM_KERNEL);								//float和int8核函数的得分与double不完全相同
+	for (auto w : weight.trans)
+	{
+		append_value(config,w);
+	}
+	for (auto w : {weight.lm,weight.len,weight.rule_num,weight.glue,weight.nnjm})
+	{
+		append_value(config,w);
+	}
+	return util::MurmurHash64A(config.data(),config.size());
+}
+
+TransCache::TransCache(const string &cache_file, uint64_t i_config_hash)
+{
+	config_hash = i_config_hash;
+	indexed_size = TRANS_CACHE_HEADER_SIZE;
+	hit_num = 0;
+	query_num = 0;
+	map_addr = NULL;
+	map_size = 0;
+	fd = open(cache_file.c_str(),O_RDWR|O_CREAT,0644);
+	if (fd == -1)
+	{
+		cerr<<"cannot open translation cache file "<<cache_file<<endl;
+		exit(EXIT_FAILURE);
+	}
+	flock(fd,LOCK_EX);
+	struct stat st;
+	if (fstat(fd,&st) == -1)
+	{
+		cerr<<"cannot stat translation cache file "<<cache_file<<endl;
+		exit(EXIT_FAILURE);
+	}
+	char magic[TRANS_CACHE_HEADER_SIZE];
+	if (st.st_size == 0)
+	{
+		if (write(fd,TRANS_CACHE_MAGIC,TRANS_CACHE_HEADER_SIZE) != (ssize_t)TRANS_CACHE_HEADER_SIZE)
+		{
+			cerr<<"cannot write translation cache file "<<cache_file<<endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if (st.st_size < (off_t)TRANS_CACHE_HEADER_SIZE || pread(fd,magic,TRANS_CACHE_HEADER_SIZE,0) != (ssize_t)TRANS_CACHE_HEADER_SIZE
+			 || memcmp(magic,TRANS_CACHE_MAGIC,TRANS_CACHE_HEADER_SIZE) != 0)
+	{
+		cerr<<"wrong translation cache file format: "<<cache_file<<endl;
+		exit(EXIT_FAILURE);
+	}
+	flock(fd,LOCK_UN);
+	index_new_records();
+}
+
+TransCache::~TransCache()
+{
+	if (map_addr != NULL)
+	{
+		munmap(map_addr,map_size);
+	}
+	close(fd);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 保证缓存文件的前file_size个字节都在映射中
+ 2. 入口参数: 需要访问的文件长度
+ 3. 出口参数: 无
+ 4. 算法简介: 映射长度不够时扩大为文件长度的两倍(至少TRANS_CACHE_MAP_MIN), 第一次用mmap,
+              之后用mremap在原映射上扩大, 整个缓存只占用一个映射区域; 映射中超出文件末尾的
+              部分不会被访问, 文件被追加后这部分自动对应新的内容
+************************************************************************************* */
+void TransCache::map_file(uint64_t file_size)
+{
+	if (file_size <= map_size)
+		return;
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	size_t new_size = (max((uint64_t)TRANS_CACHE_MAP_MIN,2*file_size)+page_size-1)/page_size*page_size;
+	void *addr;
+	if (map_addr == NULL)
+	{
+		addr = mmap(NULL,new_size,PROT_READ,MAP_SHARED,fd,0);
+	}
+	else
+	{
+		addr = mremap(map_addr,map_size,new_size,MREMAP_MAYMOVE);
+	}
+	if (addr == MAP_FAILED)
+	{
+		cerr<<"cannot map translation cache file\n";
+		exit(EXIT_FAILURE);
+	}
+	map_addr = (char*)addr;
+	map_size = new_size;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 索引缓存文件中尚未建立索引的记录
+ 2. 入口参数: 无
+ 3. 出口参数: 无
+ 4. 算法简介: a) 按当前文件长度扩大映射
+              b) 依次解析完整的记录, 只索引配置哈希值与当前配置相同的记录;
+                 末尾不完整的记录(其他进程正在写入)留到下次索引
+************************************************************************************* */
+void TransCache::index_new_records()
+{
+	struct stat st;
+	if (fstat(fd,&st) == -1)
+	{
+		cerr<<"cannot stat translation cache file\n";
+		exit(EXIT_FAILURE);
+	}
+	uint64_t file_size = st.st_size;
+	if (file_size <= indexed_size)
+		return;
+	map_file(file_size);
+	const char *base = map_addr;
+	const size_t len_size = 2*sizeof(uint32_t);
+	while (indexed_size + len_size <= file_size)
+	{
+		ValueReader reader(base+indexed_size);
+		uint32_t key_len = reader.read<uint32_t>();
+		uint32_t value_len = reader.read<uint32_t>();
+		uint64_t record_end = indexed_size + len_size + key_len + value_len;
+		if (record_end > file_size)
+			break;
+		const char *key_data = base + indexed_size + len_size;
+		uint64_t record_hash;
+		if (key_len >= sizeof(uint64_t))
+		{
+			memcpy(&record_hash,key_data,sizeof(uint64_t));
+			if (record_hash == config_hash)
+			{
+				key2value[string(key_data,key_len)] = indexed_size + len_size + key_len;
+			}
+		}
+		indexed_size = record_end;
+	}
+}
+
+//键为配置哈希值加上去掉多余空白的输入行
+string TransCache::make_key(const string &src_line)
+{
+	string key;
+	append_value(key,config_hash);
+	string line = src_line;
+	vector<string> words;
+	Split(words,line);
+	for (size_t i=0;i<words.size();i++)
+	{
+		if (i != 0)
+		{
+			key += ' ';
+		}
+		key += words.at(i);
+	}
+	return key;
+}
+
+bool TransCache::find(const string &src_line, TransResult &result)
+{
+	query_num++;
+	string key = make_key(src_line);
+	auto it = key2value.find(key);
+	if (it == key2value.end())
+	{
+		index_new_records();
+		it = key2value.find(key);
+		if (it == key2value.end())
+			return false;
+	}
+	hit_num++;
+	decode_result(map_addr+it->second,result);
+	return true;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 将输入行的翻译结果追加到缓存文件中
+ 2. 入口参数: 输入行, 翻译结果
+ 3. 出口参数: 无
+ 4. 算法简介: 整条记录用一次write加锁追加到文件末尾, 之后重新索引, 使新记录以及其他进程
+              在此之前追加的记录都可以被查到
+************************************************************************************* */
+void TransCache::insert(const string &src_line, const TransResult &result)
+{
+	string key = make_key(src_line);
+	if (key2value.find(key) != key2value.end())
+		return;
+	string value = encode_result(result);
+	string record;
+	append_value(record,(uint32_t)key.size());
+	append_value(record,(uint32_t)value.size());
+	record += key;
+	record += value;
+	flock(fd,LOCK_EX);
+	lseek(fd,0,SEEK_END);
+	if (write(fd,record.data(),record.size()) != (ssize_t)record.size())
+	{
+		cerr<<"fail to write translation cache file\n";
+		exit(EXIT_FAILURE);
+	}
+	flock(fd,LOCK_UN);
+	index_new_records();
+}
+
+string TransCache::encode_result(const TransResult &result)
+{
+	string out;
+	append_value(out,(uint32_t)result.translations.size());
+	for (const auto &translation : result.translations)
+	{
+		append_string(out,translation);
+	}
+	append_value(out,(uint32_t)result.nbest_lists.size());
+	for (const auto &nbest_list : result.nbest_lists)
+	{
+		append_value(out,(uint32_t)nbest_list.size());
+		for (const auto &tune_info : nbest_list)
+		{
+			append_string(out,tune_info.translation);
+			append_value(out,(uint32_t)tune_info.feature_values.size());
+			for (auto v : tune_info.feature_values)
+			{
+				append_value(out,v);
+			}
+			append_value(out,tune_info.total_score);
+		}
+	}
+	append_value(out,(uint32_t)result.applied_rules_list.size());
+	for (const auto &applied_rules : result.applied_rules_list)
+	{
+		append_value(out,(uint32_t)applied_rules.size());
+		for (const auto &applied_rule : applied_rules)
+		{
+			append_string(out,applied_rule);
+		}
+	}
+	return out;
+}
+
+void TransCache::decode_result(const char *data, TransResult &result)
+{
+	ValueReader reader(data);
+	result.translations.resize(reader.read<uint32_t>());
+	for (auto &translation : result.translations)
+	{
+		translation = reader.read_string();
+	}
+	result.nbest_lists.resize(reader.read<uint32_t>());
+	for (auto &nbest_list : result.nbest_lists)
+	{
+		nbest_list.resize(reader.read<uint32_t>());
+		for (auto &tune_info : nbest_list)
+		{
+			tune_info.translation = reader.read_string();
+			tune_info.feature_values.resize(reader.read<uint32_t>());
+			for (auto &v : tune_info.feature_values)
+			{
+				v = reader.read<double>();
+			}
+			tune_info.total_score = reader.read<double>();
+		}
+	}
+	result.applied_rules_list.resize(reader.read<uint32_t>());
+	for (auto &applied_rules : result.applied_rules_list)
+	{
+		applied_rules.resize(reader.read<uint32_t>());
+		for (auto &applied_rule : applied_rules)
+		{
+			applied_rule = reader.read_string();
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef TRANSCACHE_H
+#define TRANSCACHE_H
+#include "stdafx.h"
+
+//一行输入(段落)的完整翻译结果
+struct TransResult
+{
+	vector<string> translations;					//每个句子的1-best译文
+	vector<vector<TuneInfo> > nbest_lists;			//每个句子的n-best列表, 未输出n-best时为空
+	vector<vector<string> > applied_rules_list;		//每个句子所使用的规则, 未输出规则时为空
+};
+
+//计算影响翻译结果的模型文件(文件名、长度和修改时间)、参数和特征权重的哈希值, 配置不同的缓存条目互不可见
+uint64_t get_config_hash(const Filenames &fns, const Parameter &para, const Weight &weight);
+
+//完全重复的输入行的翻译缓存, 以规范化后的输入行和配置的哈希值为键
+//缓存文件格式: 文件头为4字节TRANS_CACHE_MAGIC, 之后为若干条记录,
+//每条记录为uint32键长度, uint32值长度, 键(8字节配置哈希值+规范化的输入行), 值(序列化的TransResult)
+//打开时将文件映射到内存并建立索引, 新的翻译结果加锁后追加到文件末尾, 因此多个进程可以共享同一个缓存文件;
+//查找未命中时检查文件是否被其他进程追加过, 如果是则索引新增的部分; 整个文件只有一个映射,
+//映射长度按倍数预留, 文件超出映射长度时用mremap扩大, 索引中保存记录在文件中的偏移
+//缓存文件的读写出错时程序以非零状态退出
+//只在主线程中调用, 不是线程安全的
+class TransCache
+{
+	public:
+		TransCache(const string &cache_file, uint64_t i_config_hash);
+		~TransCache();
+		bool find(const string &src_line, TransResult &result);
+		void insert(const string &src_line, const TransResult &result);
+		pair<size_t,size_t> get_hit_stats() { return make_pair(hit_num,query_num); }
+
+	private:
+		string make_key(const string &src_line);
+		void map_file(uint64_t file_size);
+		void index_new_records();
+		void decode_result(const char *data, TransResult &result);
+		string encode_result(const TransResult &result);
+
+	private:
+		int fd;
+		uint64_t config_hash;
+		uint64_t indexed_size;								//已经建立索引的文件长度
+		char *map_addr;										//整个缓存文件的只读映射, 长度可能超过文件长度
+		size_t map_size;
+		unordered_map<string,uint64_t> key2value;			//键到序列化的翻译结果在文件中的偏移
+		size_t hit_num;
+		size_t query_num;
+};
+
+#endif
@@ -8,8 +8,14 @@ SentenceTranslator::SentenceTranslator(const Models &i_models, const Parameter &
 	lm_model = i_models.lm_model;
     nnjm_model = i_models.nnjm_model;
     function_words = i_models.function_words;
+    phrase_cache = i_models.phrase_cache;
+    nnjm_cache = i_models.nnjm_cache;
+    fast_nnjm = i_models.fast_nnjm;
 	para = i_para;
 	feature_weight = i_weight;
+	keep_recombined = para.PRINT_NBEST || para.DUMP_HYPERGRAPH;
+	lm_memo_hit_num = 0;
+	lm_memo_query_num = 0;
 
 	src_nt_id = src_vocab->get_id("[X][X]");
 	tgt_nt_id = tgt_vocab->get_id("[X][X]");
@@ -17,8 +23,8 @@ SentenceTranslator::SentenceTranslator(const Models &i_models, const Parameter &
     src_bos_nnjm_id = nnjm_model->lookup_input_word("<src>");
     src_eos_nnjm_id = nnjm_model->lookup_input_word("</src>");
     tgt_bos_nnjm_id = nnjm_model->lookup_input_word("<tgt>");
-    src_window_size = 5;
-    tgt_window_size = 3;
+    src_window_size = NNJM_SRC_WINDOW;
+    tgt_window_size = NNJM_TGT_WINDOW;
 
     src_nnjm_ids.resize(src_window_size,src_bos_nnjm_id);
 	stringstream ss(input_sen);
@@ -32,7 +38,6 @@ SentenceTranslator::SentenceTranslator(const Models &i_models, const Parameter &
             int span = i - beg - 1;                         //span=0表示句子包含1个词
             sen_spans.push_back(make_pair(beg,span));
             beg = i + 1;
-            eos_indexes.push_back(i);
             src_wids.push_back(-1);
             src_nnjm_ids.push_back(-1);
         }
@@ -78,27 +83,59 @@ SentenceTranslator::SentenceTranslator(const Models &i_models, const Parameter &
         }
         src_windows.push_back(cur_context);
     }
+    if (para.NNJM_PRECOMPUTE)
+    {
+        //源端窗口在整个句子的解码过程中不变, 其对第一隐层的贡献对每个位置只计算一次
+        if (fast_nnjm != NULL)
+        {
+            src_window_fast_hiddens.resize(src_sen_len);
+        }
+        else
+        {
+            src_window_hiddens.resize(src_sen_len);
+        }
+        for (int i=0; i<src_sen_len; i++)
+        {
+            if (src_wids.at(i) == -1)
+                continue;
+            if (fast_nnjm != NULL)
+            {
+                src_window_fast_hiddens.at(i).resize(fast_nnjm->get_hidden_dim()+NNJM_SIMD_WIDTH);
+                fast_nnjm->precompute_prefix(src_windows.at(i).data(),src_windows.at(i).size(),src_window_fast_hiddens.at(i).data());
+            }
+            else
+            {
+                nnjm_model->precompute_prefix(src_windows.at(i).data(),src_windows.at(i).size(),src_window_hiddens.at(i));
+            }
+        }
+    }
 
-	span2validflag.resize(src_sen_len);
-	sen_span_dict.resize(src_sen_len);
-	span2cands.resize(src_sen_len);
-	span2rules.resize(src_sen_len);
-	for (size_t beg=0;beg<src_sen_len;beg++)
-	{
-		span2validflag.at(beg).resize(src_sen_len-beg,true);
-		sen_span_dict.at(beg).resize(src_sen_len-beg,false);
-		span2cands.at(beg).resize(src_sen_len-beg);
-		span2rules.at(beg).resize(src_sen_len-beg);
-	}
-
-    for (auto sen_span : sen_spans)
+	//每个句子使用各自的三角形chart, 起始位置为beg的行只包含到beg所在句子末尾的跨度,
+	//EOS以及不属于任何句子的位置对应的行为空, 因此跨越EOS的跨度不占用内存
+	span2validflag.init(sen_spans,src_sen_len);
+	span2validflag.fill(true);
+	span2cands.init(sen_spans,src_sen_len);
+	span2rules.init(sen_spans,src_sen_len);
+	sen_len_of_beg.resize(src_sen_len,-1);
+    for (auto &sen_span : sen_spans)
     {
-        sen_span_dict.at(sen_span.first).at(sen_span.second) = true;
+        sen_len_of_beg.at(sen_span.first) = sen_span.second;
+    }
+    if (para.BEAM_THRESHOLD > 0)
+    {
+        for (auto &candbeam : span2cands)
+        {
+            candbeam.set_threshold(para.BEAM_THRESHOLD);
+        }
     }
+	cube_stats.resize(src_sen_len);
 
-	fill_span2validflag();
-	fill_span2cands_with_phrase_rules();
 	fill_span2rules_with_hiero_rules();
+	if (para.COARSE_TO_FINE == true)
+	{
+		prune_span2rules_with_coarse_pass();
+	}
+	fill_span2cands_with_phrase_rules();
 
     null_cand = new Cand;
     null_cand->rule_num = 0;
@@ -109,32 +146,28 @@ SentenceTranslator::SentenceTranslator(const Models &i_models, const Parameter &
 SentenceTranslator::~SentenceTranslator()
 {
     delete null_cand;
-	for (size_t i=0;i<span2cands.size();i++)
+	for (auto &candbeam : span2cands)
 	{
-		for(size_t j=0;j<span2cands.at(i).size();j++)
-		{
-			span2cands.at(i).at(j).free();
-		}
+		candbeam.free();
 	}
 }
 
-void SentenceTranslator::fill_span2validflag()
+//返回假设重组的次数, 以及其中目标端完全相同的候选被重组的次数
+pair<size_t,size_t> SentenceTranslator::get_recomb_stats()
 {
-	for (size_t beg=0;beg<src_sen_len;beg++)
+	pair<size_t,size_t> recomb_stats = make_pair(0,0);
+	for (auto &candbeam : span2cands)
 	{
-		for (size_t span=0;beg+span<src_sen_len;span++)	//span=0对应跨度包含1个词的情况
-		{
-            int end = beg + span;
-            for (int eos_idx : eos_indexes)
-            {
-                if (beg<=eos_idx && end>=eos_idx)
-                {
-                    span2validflag[beg][span] = false;
-                    break;
-                }
-            }
-		}
+		recomb_stats.first += candbeam.get_recomb_num();
+		recomb_stats.second += candbeam.get_same_str_recomb_num();
 	}
+	return recomb_stats;
+}
+
+//跨度是否在chart中并且没有被剪掉
+bool SentenceTranslator::is_valid_span(size_t beg, size_t span)
+{
+    return span2validflag.contains(beg,span) && span2validflag(beg,span);
 }
 
 /**************************************************************************************
@@ -145,73 +178,134 @@ void SentenceTranslator::fill_span2validflag()
               a.1) 如果该跨度包含1个单词, 则生成对应的OOV候选
               a.2) 如果该跨度包含多个单词, 则不作处理
               b) 如果某个跨度匹配到了规则, 则根据规则生成候选
+                 b.1) 使用短语缓存时, 先按源端短语查找缓存, 命中时直接复用语言模型得分、状态以及
+                      目标端单词对应的源端位置, 只重新计算与句子相关的nnjm得分
+                 b.2) 未命中时正常计算, 并将与句子无关的部分加入缓存
 ************************************************************************************* */
 void SentenceTranslator::fill_span2cands_with_phrase_rules()
 {
 	for (size_t beg=0;beg<src_sen_len;beg++)
 	{
+        if (span2cands.row_size(beg) == 0)
+            continue;
 		vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(src_wids,beg);
 		for (size_t span=0;span<matched_rules_for_prefixes.size();span++)	//span=0对应跨度包含1个词的情况
 		{
-            if (span2validflag[beg][span] == false)
+            if (is_valid_span(beg,span) == false)
                 continue;
 			if (matched_rules_for_prefixes.at(span) == NULL)
 			{
 				if (span == 0)
 				{
 					Cand* cand = new Cand;
-					cand->tgt_wids.push_back(0 - src_wids.at(beg));
 					cand->trans_probs.resize(PROB_NUM,0.0);
 					cand->applied_rule.src_ids.push_back(src_wids.at(beg));
                     cand->applied_rule.span = make_pair(beg,span);
 					cand->lm_prob = lm_model->cal_increased_lm_score(cand);
-                    cand->aligned_src_idx.push_back(beg);
                     cand->span = make_pair(beg,span);
-                    cand->nnjm_ngram_score.resize(1,0.0);
-                    cand->nnjm_prob = cal_nnjm_score(cand);
+                    build_tgt_seq(cand,tgt_seq);
+                    cand->nnjm_prob = cal_nnjm_score(cand,tgt_seq);
+                    update_tgt_bound(cand,tgt_seq);
 					cand->score += feature_weight.rule_num*cand->rule_num + feature_weight.len*cand->tgt_word_num 
                                    + feature_weight.lm*cand->lm_prob + feature_weight.nnjm*cand->nnjm_prob;
-					span2cands.at(beg).at(span).add(cand,para.BEAM_SIZE);
+					span2cands(beg,span).add(cand,para.BEAM_SIZE,keep_recombined);
 				}
 				continue;
 			}
-			for (auto &tgt_rule : *matched_rules_for_prefixes.at(span))
+			vector<TgtRule> &matched_rules = *matched_rules_for_prefixes.at(span);
+			vector<int> src_ids(src_wids.begin()+beg,src_wids.begin()+beg+span+1);
+			PhraseInfos cached_infos;
+			vector<PhraseInfo> *new_infos = NULL;
+			if (phrase_cache != NULL)
+			{
+				cached_infos = phrase_cache->find(src_ids);
+				if (cached_infos == NULL)
+				{
+					new_infos = new vector<PhraseInfo>(matched_rules.size());
+				}
+			}
+			for (size_t i=0;i<matched_rules.size();i++)
 			{
+				TgtRule &tgt_rule = matched_rules.at(i);
 				Cand* cand = new Cand;
 				cand->tgt_word_num = tgt_rule.word_num;
-				cand->tgt_wids = tgt_rule.wids;
 				cand->trans_probs = tgt_rule.probs;
 				cand->score = tgt_rule.score;
-				vector<int> src_ids(src_wids.begin()+beg,src_wids.begin()+beg+span+1);
 				cand->applied_rule.src_ids = src_ids;
                 cand->applied_rule.span = make_pair(beg,span);
 				cand->applied_rule.tgt_rule = &tgt_rule;
-				cand->lm_prob = lm_model->cal_increased_lm_score(cand);
-                cand->aligned_src_idx = get_aligned_src_idx(beg,tgt_rule,NULL,NULL);
                 cand->span = make_pair(beg,span);
-                cand->nnjm_ngram_score.resize(cand->tgt_wids.size(),0.0);
-                cand->nnjm_prob = cal_nnjm_score(cand);
+				if (cached_infos != NULL)
+				{
+					const PhraseInfo &phrase_info = cached_infos->at(i);
+					cand->lm_prob = phrase_info.lm_prob;
+					cand->lm_state = phrase_info.lm_state;
+					build_phrase_tgt_seq(beg,phrase_info,tgt_rule,tgt_seq);
+				}
+				else
+				{
+					cand->lm_prob = lm_model->cal_increased_lm_score(cand);
+					build_tgt_seq(cand,tgt_seq);
+					if (new_infos != NULL)
+					{
+						PhraseInfo &phrase_info = new_infos->at(i);
+						phrase_info.lm_prob = cand->lm_prob;
+						phrase_info.lm_state = cand->lm_state;
+						for (auto src_idx : tgt_seq.src_idx)
+						{
+							phrase_info.src_offsets.push_back(src_idx-beg);
+						}
+					}
+				}
+                cand->nnjm_prob = cal_nnjm_score(cand,tgt_seq);
+                update_tgt_bound(cand,tgt_seq);
 
 				cand->score += feature_weight.rule_num*cand->rule_num + feature_weight.len*cand->tgt_word_num
                                + feature_weight.lm*cand->lm_prob + feature_weight.nnjm*cand->nnjm_prob;
-				span2cands.at(beg).at(span).add(cand,para.BEAM_SIZE);
+				span2cands(beg,span).add(cand,para.BEAM_SIZE,keep_recombined);
+			}
+			if (new_infos != NULL)
+			{
+				phrase_cache->insert(src_ids,PhraseInfos(new_infos));
 			}
 		}
 	}
 }
 
+//根据缓存的源端位置偏移生成短语候选的压缩目标端序列, 与build_tgt_seq对短语规则的结果相同
+void SentenceTranslator::build_phrase_tgt_seq(int beg, const PhraseInfo &phrase_info, TgtRule &tgt_rule, TgtSeq &seq)
+{
+    seq.clear();
+    for (size_t i=0; i<phrase_info.src_offsets.size(); i++)
+    {
+        seq.push_back(tgt_rule.wids.at(i),beg+phrase_info.src_offsets.at(i),i,true);
+    }
+}
+
 /**************************************************************************************
- 1. 函数功能: 计算当前候选每个目标端单词对应的源端位置
- 2. 入口参数: 当前候选对应的源端起始位置，规则内部每个目标端符号对应的规则源端位置
-              当前候选的两个子候选
- 3. 出口参数: 每个目标端单词对应的源端位置
+ 1. 函数功能: 生成当前候选的压缩目标端序列, 并计算每个单词对应的源端位置
+ 2. 入口参数: 已经设置好规则和子候选的当前候选
+ 3. 出口参数: 压缩目标端序列
  4. 算法简介: a) 对于有对齐的目标端单词，使用候选对应的源端起始位置加上该单词在规则内部
                  对应的源端位置，再加上非终结符导致的位置偏移
-              b) 对于对空的目标端单词，使用临近的目标端单词对应的源端位置
-              c) 对于目标端的非终结符，使用子候选的目标端单词到源端位置的映射
+              b) 对于目标端的非终结符，使用子候选开头和结尾的边界单词, 开头的边界单词
+                 nnjm得分尚未计算, 结尾的边界单词只作为目标端历史
+              c) 对于对空的目标端单词，使用临近的目标端单词对应的源端位置, 由于子候选的
+                 单词都有对应的源端位置, 临近单词不会落在被省略的子候选中间部分
 ************************************************************************************* */
-vector<int> SentenceTranslator::get_aligned_src_idx(int beg, TgtRule &tgt_rule, Cand* cand_x1, Cand* cand_x2)
+void SentenceTranslator::build_tgt_seq(Cand *cand, TgtSeq &seq)
 {
+    seq.clear();
+    int beg = cand->span.first;
+    if (cand->applied_rule.tgt_rule == NULL)                              //OOV候选
+    {
+        seq.push_back(0 - src_wids.at(beg),beg,0,true);
+        return;
+    }
+    TgtRule &tgt_rule = *(cand->applied_rule.tgt_rule);
+    Cand* cand_x1 = cand->child_x1;
+    Cand* cand_x2 = cand->child_x2 != NULL ? cand->child_x2 : null_cand;
+
     int nt1_idx = -1, nt2_idx = -1;
     int offset1 = 0, offset2 = 0;
     int nt_num = 1;
@@ -231,48 +325,47 @@ vector<int> SentenceTranslator::get_aligned_src_idx(int beg, TgtRule &tgt_rule,
         }
     }
 
-    vector<int> tgt_to_src_idx_with_offset = tgt_rule.tgt_to_src_idx;
-    for (int i=0; i<tgt_rule.tgt_to_src_idx.size(); i++)                  //处理偏置量
-    {
-        int src_idx = tgt_rule.tgt_to_src_idx.at(i);
-        int tgt_wid = tgt_rule.wids.at(i);
-        if (tgt_wid == tgt_nt_id || src_idx == -1)
-            continue;
-        if (nt1_idx != -1 && src_idx > nt1_idx)
-        {
-            tgt_to_src_idx_with_offset.at(i) += offset1;
-        }
-        if (nt2_idx != -1 && src_idx > nt2_idx)
-        {
-            tgt_to_src_idx_with_offset.at(i) += offset2;
-        }
-    }
-
-    vector<int> aligned_src_idx;
+    int pos = 0;
     nt_num = 1;
-    for (int i=0; i<tgt_to_src_idx_with_offset.size(); i++)               //将规则中的相对位置转换成句子中的绝对位置
+    for (int i=0; i<tgt_rule.tgt_to_src_idx.size(); i++)                  //将规则中的相对位置转换成句子中的绝对位置
     {
-        int src_idx = tgt_to_src_idx_with_offset.at(i);
+        int src_idx = tgt_rule.tgt_to_src_idx.at(i);
         int tgt_wid = tgt_rule.wids.at(i);
-        if (tgt_wid == tgt_nt_id && nt_num == 1)                          //第一个非终结符
+        if (tgt_wid == tgt_nt_id)
         {
-            aligned_src_idx.insert(aligned_src_idx.end(),cand_x1->aligned_src_idx.begin(),cand_x1->aligned_src_idx.end());
+            Cand* sub_cand = nt_num == 1 ? cand_x1 : cand_x2;
+            int len = sub_cand->tgt_word_num;
+            int bound_len = min(len,(int)NNJM_TGT_WINDOW);
+            for (int j=0; j<bound_len; j++)
+            {
+                seq.push_back(sub_cand->left_wids[j],sub_cand->left_src_idx[j],pos+j,true);
+            }
+            for (int j=max(bound_len,len-bound_len); j<len; j++)
+            {
+                int k = j - (len - bound_len);
+                seq.push_back(sub_cand->right_wids[k],sub_cand->right_src_idx[k],pos+j,false);
+            }
+            pos += len;
             nt_num++;
+            continue;
         }
-        else if (tgt_wid == tgt_nt_id && nt_num == 2)                     //第二个非终结符
-        {
-            aligned_src_idx.insert(aligned_src_idx.end(),cand_x2->aligned_src_idx.begin(),cand_x2->aligned_src_idx.end());
-        }
-        else if (src_idx == -1)
-        {
-            aligned_src_idx.push_back(-1);
-        }
-        else
+        if (src_idx != -1)                                                //处理偏置量
         {
-            aligned_src_idx.push_back(beg+src_idx);
+            if (nt1_idx != -1 && src_idx > nt1_idx)
+            {
+                src_idx += offset1;
+            }
+            if (nt2_idx != -1 && src_idx > nt2_idx)
+            {
+                src_idx += offset2;
+            }
+            src_idx += beg;
         }
+        seq.push_back(tgt_wid,src_idx,pos,true);
+        pos++;
     }
 
+    vector<int> &aligned_src_idx = seq.src_idx;
     for (int i=0;i<aligned_src_idx.size();i++)      //处理对空的单词
     {
         if (aligned_src_idx.at(i) == -1)
@@ -293,77 +386,297 @@ vector<int> SentenceTranslator::get_aligned_src_idx(int beg, TgtRule &tgt_rule,
         }
         assert(aligned_src_idx.at(i) != -1);
     }
-    return aligned_src_idx;
 }
 
 /**************************************************************************************
- 1. 函数功能: 计算当前候选的nnjm得分
- 2. 入口参数: 当前候选
+ 1. 函数功能: 根据压缩目标端序列更新当前候选的边界单词以及目标端id序列的哈希值
+ 2. 入口参数: 当前候选, 压缩目标端序列
+ 3. 出口参数: 无
+ 4. 算法简介: 压缩序列的开头和结尾至少包含完整序列开头和结尾的NNJM_TGT_WINDOW个单词
+************************************************************************************* */
+void SentenceTranslator::update_tgt_bound(Cand *cand, TgtSeq &seq)
+{
+    int len = seq.size() == 0 ? 0 : seq.pos.back() + 1;
+    cand->tgt_word_num = len;
+    int bound_len = min(len,(int)NNJM_TGT_WINDOW);
+    for (int i=0; i<bound_len; i++)
+    {
+        cand->left_wids[i] = seq.wids.at(i);
+        cand->left_src_idx[i] = seq.src_idx.at(i);
+        cand->right_wids[i] = seq.wids.at(seq.size()-bound_len+i);
+        cand->right_src_idx[i] = seq.src_idx.at(seq.size()-bound_len+i);
+    }
+
+    const uint64_t base = 1000003;                  //多项式哈希, 拼接时 H(ab) = H(a)*base^len(b) + H(b)
+    uint64_t str_hash = 0;
+    if (cand->applied_rule.tgt_rule == NULL)
+    {
+        str_hash = (uint32_t)seq.wids.at(0);
+    }
+    else
+    {
+        int nt_num = 1;
+        for (auto tgt_wid : cand->applied_rule.tgt_rule->wids)
+        {
+            if (tgt_wid == tgt_nt_id)
+            {
+                Cand* sub_cand = nt_num == 1 ? cand->child_x1 : cand->child_x2;
+                uint64_t factor = 1, b = base;
+                for (int e = sub_cand->tgt_word_num; e > 0; e >>= 1, b *= b)
+                {
+                    if (e & 1)
+                        factor *= b;
+                }
+                str_hash = str_hash*factor + sub_cand->tgt_str_hash;
+                nt_num++;
+            }
+            else
+            {
+                str_hash = str_hash*base + (uint32_t)tgt_wid;
+            }
+        }
+    }
+    cand->tgt_str_hash = str_hash;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 查询一个nnjm ngram的得分
+ 2. 入口参数: ngram源端窗口的中心位置, 源端窗口和目标端历史以及当前目标端单词组成的ngram
+ 3. 出口参数: nnjm得分
+ 4. 算法简介: NNJM_PRECOMPUTE时源端窗口部分使用预先计算的第一隐层贡献,
+              只需计算目标端历史的贡献以及之后的网络层, 结果与完整查询相同;
+              设置了fast_nnjm时使用float32或int8的SIMD计算
+************************************************************************************* */
+double SentenceTranslator::lookup_nnjm_score(int src_idx, const int *fifteen_gram)
+{
+    int src_window_len = 2*src_window_size+1;
+    if (fast_nnjm != NULL)
+    {
+        if (para.NNJM_PRECOMPUTE)
+            return fast_nnjm->lookup_ngram_with_prefix(src_window_fast_hiddens.at(src_idx).data(),src_window_len,fifteen_gram+src_window_len);
+        return fast_nnjm->lookup_ngram(fifteen_gram);
+    }
+    if (para.NNJM_PRECOMPUTE)
+    {
+        return nnjm_model->lookup_ngram_with_prefix(src_window_hiddens.at(src_idx),src_window_len,fifteen_gram+src_window_len);
+    }
+    return nnjm_model->lookup_ngram(fifteen_gram,NNJM_NGRAM_SIZE);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 计算当前候选新增的nnjm得分
+ 2. 入口参数: 当前候选, 压缩目标端序列
+ 3. 出口参数: 压缩序列中新计算得分的单词的nnjm得分之和
+ 4. 算法简介: 收集当前候选的nnjm查询后立即计算, 即只包含一个候选的批次
+************************************************************************************* */
+double SentenceTranslator::cal_nnjm_score(Cand *cand, TgtSeq &seq)
+{
+    double increased_nnjm_score;
+    collect_nnjm_queries(cand,seq,0);
+    cal_collected_nnjm_scores(&increased_nnjm_score,1);
+    return increased_nnjm_score;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 收集当前候选新增的nnjm得分项以及需要查询的ngram
+ 2. 入口参数: 当前候选, 压缩目标端序列, 候选在批次中的位置
  3. 出口参数: 无
- 4. 算法简介: 根据源端和目标端单词端位置获取计算每个nnjm ngram得分所需要的历史
+ 4. 算法简介: 根据源端和目标端单词端位置获取计算每个nnjm ngram得分所需要的历史,
+              目标端历史不足NNJM_TGT_WINDOW个单词时(句子级跨度除外)暂不计算;
+              得分由cal_collected_nnjm_scores对整个批次一起计算
 ************************************************************************************* */
-double SentenceTranslator::cal_nnjm_score(Cand *cand)
+void SentenceTranslator::collect_nnjm_queries(Cand *cand, TgtSeq &seq, size_t cand_idx)
 {
-    for (int tgt_idx=0;tgt_idx<cand->tgt_wids.size();tgt_idx++)
+    bool is_sen_span = sen_len_of_beg.at(cand->span.first) == cand->span.second;
+    for (int seq_idx=0;seq_idx<seq.size();seq_idx++)
     {
-        if (cand->nnjm_ngram_score.at(tgt_idx) != 0.0)
+        if (seq.unscored.at(seq_idx) == false)
             continue;
-        if (tgt_idx - tgt_window_size < 0 && sen_span_dict.at(cand->span.first).at(cand->span.second) == false)
+        int tgt_idx = seq.pos.at(seq_idx);
+        if (tgt_idx - tgt_window_size < 0 && is_sen_span == false)
             continue;
 
         vector<int> tgt_context;
         for (int i = tgt_idx - tgt_window_size; i<tgt_idx; i++)
         {
-            int nnjm_id = i<0 ? tgt_bos_nnjm_id : nnjm_model->lookup_input_word(get_tgt_word(cand->tgt_wids.at(i)));
+            int hist_idx = seq_idx - (tgt_idx - i);
+            assert(i < 0 || seq.pos.at(hist_idx) == i);
+            int nnjm_id = i<0 ? tgt_bos_nnjm_id : nnjm_model->lookup_input_word(get_tgt_word(seq.wids.at(hist_idx)));
             tgt_context.push_back(nnjm_id);
         }
-        tgt_context.push_back(nnjm_model->lookup_output_word(get_tgt_word(cand->tgt_wids.at(tgt_idx))));
+        tgt_context.push_back(nnjm_model->lookup_output_word(get_tgt_word(seq.wids.at(seq_idx))));
         
-        vector<double> nnjm_scores;
-        int src_idx = cand->aligned_src_idx.at(tgt_idx);
-        int nnjm_id = src_nnjm_ids.at(src_idx+src_window_size);
+        NnjmTerm term;
+        term.cand_idx = cand_idx;
+        term.slot_beg = nnjm_slots.size();
+        int src_idx = seq.src_idx.at(seq_idx);
         int src_wid = src_wids.at(src_idx);
         string src_word = src_vocab->get_word(src_wid);
-        string tgt_word = get_tgt_word(cand->tgt_wids.at(tgt_idx));
+        string tgt_word = get_tgt_word(seq.wids.at(seq_idx));
         if (function_words->find(src_word) != function_words->end() || function_words->find(tgt_word) != function_words->end())
         {
-            vector<int> fifteen_gram = src_windows.at(src_idx);
-            fifteen_gram.insert(fifteen_gram.end(),tgt_context.begin(),tgt_context.end());
-            auto it = nnjm_score_cache.find(fifteen_gram);
-            if (it != nnjm_score_cache.end())
+            add_nnjm_slot(src_idx,tgt_context);
+        }
+        else
+        {
+            for (auto idx : wid_to_indexes[src_wid])
             {
-                nnjm_scores.push_back(it->second);
+                add_nnjm_slot(idx,tgt_context);
             }
-            else
+        }
+        term.slot_end = nnjm_slots.size();
+        nnjm_terms.push_back(term);
+    }
+}
+
+//为一个ngram得分添加槽, ngram由源端位置src_idx的窗口和目标端历史以及当前目标端单词组成,
+//缓存(共享缓存, 没有时为句子内缓存)中没有且本批次尚未查询的ngram加入待查询列表
+void SentenceTranslator::add_nnjm_slot(int src_idx, const vector<int> &tgt_context)
+{
+    NnjmFullKey full_key;
+    int *fifteen_gram = full_key.ids;
+    const vector<int> &src_window = src_windows.at(src_idx);
+    copy(src_window.begin(),src_window.end(),fifteen_gram);
+    copy(tgt_context.begin(),tgt_context.end(),fifteen_gram+src_window.size());
+
+    NnjmSlot slot;
+    bool is_cached = false;
+    if (nnjm_cache != NULL)                         //共享缓存只在所有id都能压缩为16位时创建
+    {
+        NnjmKey key;
+        key.pack(fifteen_gram);
+        is_cached = nnjm_cache->find(key,slot.score);
+    }
+    else
+    {
+        auto it = nnjm_score_cache.find(full_key);
+        if (it != nnjm_score_cache.end())
+        {
+            slot.score = it->second;
+            is_cached = true;
+        }
+    }
+    if (is_cached == true)
+    {
+        slot.query_idx = -1;
+    }
+    else
+    {
+        auto ret = nnjm_query_indexes.insert(make_pair(full_key,(int)nnjm_query_src_idxes.size()));
+        if (ret.second == true)
+        {
+            nnjm_query_ngrams.insert(nnjm_query_ngrams.end(),fifteen_gram,fifteen_gram+NNJM_NGRAM_SIZE);
+            nnjm_query_src_idxes.push_back(src_idx);
+        }
+        slot.score = 0.0;
+        slot.query_idx = ret.first->second;
+    }
+    nnjm_slots.push_back(slot);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 计算collect_nnjm_queries收集的一批候选的nnjm得分增量
+ 2. 入口参数: 批次中的候选个数
+ 3. 出口参数: 每个候选的nnjm得分增量
+ 4. 算法简介: a) NNJM_BATCH_SIZE大于0时, 所有待查询的ngram每NNJM_BATCH_SIZE个一组交给nnjm批量计算,
+                 第二隐层由逐个ngram的矩阵向量乘法变为一次矩阵矩阵乘法; 否则(或使用fast_nnjm时)逐个查询
+              b) 查询结果加入共享缓存(没有时加入句子内缓存), 每个目标端单词的得分为其所有槽的平均值
+************************************************************************************* */
+void SentenceTranslator::cal_collected_nnjm_scores(double *increased_nnjm_probs, size_t cand_num)
+{
+    size_t query_num = nnjm_query_src_idxes.size();
+    nnjm_query_scores.resize(query_num);
+    if (query_num > 0 && para.NNJM_BATCH_SIZE > 0 && fast_nnjm == NULL)
+    {
+        const Eigen::VectorXd *const *partials = NULL;
+        if (para.NNJM_PRECOMPUTE)
+        {
+            nnjm_query_partials.resize(query_num);
+            for (size_t i=0;i<query_num;i++)
             {
-                double score = nnjm_model->lookup_ngram(fifteen_gram);
-                nnjm_score_cache.insert(make_pair(fifteen_gram,score));
-                nnjm_scores.push_back(score);
+                nnjm_query_partials[i] = &src_window_hiddens.at(nnjm_query_src_idxes[i]);
             }
+            partials = nnjm_query_partials.data();
+        }
+        nnjm_model->lookup_ngrams(nnjm_query_ngrams.data(),query_num,nnjm_query_scores.data(),partials,2*src_window_size+1);
+    }
+    else
+    {
+        for (size_t i=0;i<query_num;i++)
+        {
+            nnjm_query_scores[i] = lookup_nnjm_score(nnjm_query_src_idxes[i],nnjm_query_ngrams.data()+i*NNJM_NGRAM_SIZE);
+        }
+    }
+    if (nnjm_cache != NULL)
+    {
+        for (size_t i=0;i<query_num;i++)
+        {
+            NnjmKey key;
+            key.pack(nnjm_query_ngrams.data()+i*NNJM_NGRAM_SIZE);
+            nnjm_cache->insert(key,nnjm_query_scores[i]);
+        }
+    }
+    else
+    {
+        for (auto &kv : nnjm_query_indexes)
+        {
+            nnjm_score_cache.insert(make_pair(kv.first,nnjm_query_scores[kv.second]));
+        }
+    }
+
+    fill(increased_nnjm_probs,increased_nnjm_probs+cand_num,0.0);
+    for (auto &term : nnjm_terms)
+    {
+        double sum = 0.0;
+        for (size_t i=term.slot_beg;i<term.slot_end;i++)
+        {
+            NnjmSlot &slot = nnjm_slots[i];
+            sum += slot.query_idx == -1 ? slot.score : nnjm_query_scores[slot.query_idx];
+        }
+        //increased_nnjm_score += *max_element(nnjm_scores.begin(),nnjm_scores.end());
+        increased_nnjm_probs[term.cand_idx] += sum/(term.slot_end-term.slot_beg);
+    }
+    nnjm_slots.clear();
+    nnjm_terms.clear();
+    nnjm_query_indexes.clear();
+    nnjm_query_ngrams.clear();
+    nnjm_query_src_idxes.clear();
+}
+
+/**************************************************************************************
+ 1. 函数功能: 获取候选完整的目标端id序列
+ 2. 入口参数: 当前候选
+ 3. 出口参数: 目标端id序列
+ 4. 算法简介: 按照规则目标端的顺序, 对非终结符递归回溯子候选, 只在输出译文时使用
+************************************************************************************* */
+vector<int> SentenceTranslator::get_tgt_wids(Cand *cand)
+{
+    vector<int> tgt_wids;
+    tgt_wids.reserve(cand->tgt_word_num);
+    append_tgt_wids(cand,tgt_wids);
+    return tgt_wids;
+}
+
+void SentenceTranslator::append_tgt_wids(Cand *cand, vector<int> &tgt_wids)
+{
+    if (cand->applied_rule.tgt_rule == NULL)                              //OOV候选
+    {
+        tgt_wids.push_back(0 - src_wids.at(cand->span.first));
+        return;
+    }
+    int nt_num = 1;
+    for (auto tgt_wid : cand->applied_rule.tgt_rule->wids)
+    {
+        if (tgt_wid == tgt_nt_id)
+        {
+            append_tgt_wids(nt_num == 1 ? cand->child_x1 : cand->child_x2,tgt_wids);
+            nt_num++;
         }
         else
         {
-            for (auto idx : wid_to_indexes[src_wid])
-            {
-                vector<int> fifteen_gram = src_windows.at(idx);
-                fifteen_gram.insert(fifteen_gram.end(),tgt_context.begin(),tgt_context.end());
-                auto it = nnjm_score_cache.find(fifteen_gram);
-                if (it != nnjm_score_cache.end())
-                {
-                    nnjm_scores.push_back(it->second);
-                }
-                else
-                {
-                    double score = nnjm_model->lookup_ngram(fifteen_gram);
-                    nnjm_score_cache.insert(make_pair(fifteen_gram,score));
-                    nnjm_scores.push_back(score);
-                }
-            }
+            tgt_wids.push_back(tgt_wid);
         }
-        //cand->nnjm_ngram_score.at(tgt_idx) = *max_element(nnjm_scores.begin(),nnjm_scores.end());
-        cand->nnjm_ngram_score.at(tgt_idx) = accumulate(nnjm_scores.begin(),nnjm_scores.end(),0.0)/nnjm_scores.size();
     }
-    return accumulate(cand->nnjm_ngram_score.begin(),cand->nnjm_ngram_score.end(),0.0);
 }
 
 string SentenceTranslator::get_tgt_word(int wid)
@@ -383,28 +696,33 @@ string SentenceTranslator::get_tgt_word(int wid)
 ************************************************************************************* */
 void SentenceTranslator::fill_span2rules_with_hiero_rules()
 {
-	fill_span2rules_with_AX_XA_XAX_rule();                            //形如AX,XA和XAX的规则
-	fill_span2rules_with_AXB_AXBX_XAXB_rule();                        //形如AXB,AXBX和XAXB的规则
-	fill_span2rules_with_AXBXC_rule();                                //形如AXBXC的规则
-	fill_span2rules_with_glue_rule();                                 //起始位置为句首，形如X1X2的规则
+    for (auto &sen_span : sen_spans)                                  //只在每个句子内部枚举pattern
+    {
+        int sen_beg = sen_span.first;
+        int sen_end = sen_span.first + sen_span.second + 1;
+        fill_span2rules_with_AX_XA_XAX_rule(sen_beg,sen_end);            //形如AX,XA和XAX的规则
+        fill_span2rules_with_AXB_AXBX_XAXB_rule(sen_beg,sen_end);        //形如AXB,AXBX和XAXB的规则
+        fill_span2rules_with_AXBXC_rule(sen_beg,sen_end);                //形如AXBXC的规则
+    }
+	init_glue_rule();                                                 //起始位置为句首，形如X1X2的规则, 解码时再展开
 }
 
 /**************************************************************************************
  1. 函数功能: 处理形如AX,XA,XAX的规则
- 2. 入口参数: 无
+ 2. 入口参数: 句子的起始位置, 句子末尾的下一个位置
  3. 出口参数: 无
  4. 算法简介: 按照终结符序列的起始位置和长度遍历所有可能的pattern
 			  p.s. beg_A+len_A为A的最后一个单词的位置
 ************************************************************************************* */
-void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
+void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule(int sen_beg, int sen_end)
 {
-	for (int beg_A=0;beg_A<src_sen_len;beg_A++)
+	for (int beg_A=sen_beg;beg_A<sen_end;beg_A++)
 	{
-		for (int len_A=0;beg_A+len_A<src_sen_len && len_A+1<=SPAN_LEN_MAX;len_A++)
+		for (int len_A=0;beg_A+len_A<sen_end && len_A+1<=SPAN_LEN_MAX;len_A++)
 		{
 			vector<int> ids_A(src_wids.begin()+beg_A,src_wids.begin()+beg_A+len_A+1);
 			//抽取形如XA的规则
-			if (beg_A != 0)
+			if (beg_A != sen_beg)
 			{
 				vector<int> ids_XA;
 				ids_XA.push_back(src_nt_id);
@@ -412,7 +730,7 @@ void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
 				vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_XA,0);
 				if (matched_rules_for_prefixes.size() == ids_XA.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
 				{
-					for (int len_X=0;len_X<beg_A && len_X+len_A+2<=SPAN_LEN_MAX;len_X++)
+					for (int len_X=0;len_X<beg_A-sen_beg && len_X+len_A+2<=SPAN_LEN_MAX;len_X++)
 					{
 						int beg_X = beg_A - len_X - 1;
 						pair<int,int> span = make_pair(beg_X,len_X+len_A+1);
@@ -423,7 +741,7 @@ void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
 				}
 			}
 			//抽取形如AX的规则
-			if (beg_A+len_A != src_sen_len - 1)
+			if (beg_A+len_A != sen_end - 1)
 			{
 				vector<int> ids_AX;
 				ids_AX = ids_A;
@@ -431,7 +749,7 @@ void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
 				vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_AX,0);
 				if (matched_rules_for_prefixes.size() == ids_AX.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
 				{
-					for (int len_X=0;beg_A+len_A+1+len_X<src_sen_len && len_A+len_X+2<=SPAN_LEN_MAX;len_X++)
+					for (int len_X=0;beg_A+len_A+1+len_X<sen_end && len_A+len_X+2<=SPAN_LEN_MAX;len_X++)
 					{
 						int beg_X = beg_A + len_A + 1;
 						pair<int,int> span = make_pair(beg_A,len_A+len_X+1);
@@ -442,7 +760,7 @@ void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
 				}
 			}
 			//抽取形如XAX的规则
-			if (beg_A != 0 && beg_A+len_A != src_sen_len - 1)
+			if (beg_A != sen_beg && beg_A+len_A != sen_end - 1)
 			{
 				vector<int> ids_XAX;
 				ids_XAX.push_back(src_nt_id);
@@ -451,9 +769,9 @@ void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
 				vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_XAX,0);
 				if (matched_rules_for_prefixes.size() == ids_XAX.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
 				{
-					for (int len_X1=0;len_X1<beg_A && len_X1+len_A+2<=SPAN_LEN_MAX-1;len_X1++)
+					for (int len_X1=0;len_X1<beg_A-sen_beg && len_X1+len_A+2<=SPAN_LEN_MAX-1;len_X1++)
 					{
-						for (int len_X2=0;beg_A+len_A+1+len_X2<src_sen_len && len_X1+len_A+len_X2<=SPAN_LEN_MAX;len_X2++)
+						for (int len_X2=0;beg_A+len_A+1+len_X2<sen_end && len_X1+len_A+len_X2<=SPAN_LEN_MAX;len_X2++)
 						{
 							int beg_X1 = beg_A - len_X1 - 1;
 							int beg_X2 = beg_A + len_A + 1;
@@ -471,15 +789,15 @@ void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
 
 /**************************************************************************************
  1. 函数功能: 处理形如AXB,AXBX,XAXB的规则
- 2. 入口参数: 无
+ 2. 入口参数: 句子的起始位置, 句子末尾的下一个位置
  3. 出口参数: 无
  4. 算法简介: 按照终结符序列的起始位置和长度遍历所有可能的pattern
 ************************************************************************************* */
-void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule()
+void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule(int sen_beg, int sen_end)
 {
-	for (int beg_AXB=0;beg_AXB<src_sen_len;beg_AXB++)
+	for (int beg_AXB=sen_beg;beg_AXB<sen_end;beg_AXB++)
 	{
-		for (int len_AXB=0;beg_AXB+len_AXB<src_sen_len && len_AXB<=SPAN_LEN_MAX;len_AXB++)
+		for (int len_AXB=0;beg_AXB+len_AXB<sen_end && len_AXB<=SPAN_LEN_MAX;len_AXB++)
 		{
 			for (int beg_X=beg_AXB+1;beg_X<beg_AXB+len_AXB;beg_X++)
 			{
@@ -489,7 +807,7 @@ void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule()
 					ids_AXB.push_back(src_nt_id);
 					ids_AXB.insert(ids_AXB.end(),src_wids.begin()+beg_X+len_X+1,src_wids.begin()+beg_AXB+len_AXB+1);
 					//抽取形如XAXB的pattern
-					if (beg_AXB != 0)
+					if (beg_AXB != sen_beg)
 					{
 						vector<int> ids_XAXB;
 						ids_XAXB.push_back(src_nt_id);
@@ -497,7 +815,7 @@ void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule()
 						vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_XAXB,0);
 						if (matched_rules_for_prefixes.size() == ids_XAXB.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
 						{
-							for (int len_X1=0;len_X1<beg_AXB && len_X1+len_AXB+2<=SPAN_LEN_MAX;len_X1++)
+							for (int len_X1=0;len_X1<beg_AXB-sen_beg && len_X1+len_AXB+2<=SPAN_LEN_MAX;len_X1++)
 							{
 								int beg_X1 = beg_AXB - len_X1 - 1;
 								pair<int,int> span = make_pair(beg_X1,len_X1+len_AXB+1);
@@ -508,7 +826,7 @@ void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule()
 						}
 					}
 					//抽取形如AXBX的pattern
-					if (beg_AXB+len_AXB != src_sen_len - 1)
+					if (beg_AXB+len_AXB != sen_end - 1)
 					{
 						vector<int> ids_AXBX;
 						ids_AXBX = ids_AXB;
@@ -516,7 +834,7 @@ void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule()
 						vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_AXBX,0);
 						if (matched_rules_for_prefixes.size() == ids_AXBX.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
 						{
-							for (int len_X2=0;beg_AXB+len_AXB+1+len_X2<src_sen_len && len_AXB+len_X2+2<=SPAN_LEN_MAX;len_X2++)
+							for (int len_X2=0;beg_AXB+len_AXB+1+len_X2<sen_end && len_AXB+len_X2+2<=SPAN_LEN_MAX;len_X2++)
 							{
 								int beg_X2 = beg_AXB + len_AXB + 1;
 								pair<int,int> span = make_pair(beg_AXB,len_AXB+len_X2+1);
@@ -543,15 +861,15 @@ void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule()
 
 /**************************************************************************************
  1. 函数功能: 处理形如AXBXC的规则
- 2. 入口参数: 无
+ 2. 入口参数: 句子的起始位置, 句子末尾的下一个位置
  3. 出口参数: 无
  4. 算法简介: 按照终结符序列的起始位置和长度遍历所有可能的pattern
 ************************************************************************************* */
-void SentenceTranslator::fill_span2rules_with_AXBXC_rule()
+void SentenceTranslator::fill_span2rules_with_AXBXC_rule(int sen_beg, int sen_end)
 {
-	for (int beg_AXBXC=0;beg_AXBXC<src_sen_len;beg_AXBXC++)
+	for (int beg_AXBXC=sen_beg;beg_AXBXC<sen_end;beg_AXBXC++)
 	{
-		for (int len_AXBXC=4;beg_AXBXC+len_AXBXC<src_sen_len && len_AXBXC<=SPAN_LEN_MAX;len_AXBXC++)
+		for (int len_AXBXC=4;beg_AXBXC+len_AXBXC<sen_end && len_AXBXC<=SPAN_LEN_MAX;len_AXBXC++)
 		{
 			for (int beg_XBX=beg_AXBXC+1;beg_XBX+2<beg_AXBXC+len_AXBXC;beg_XBX++)
 			{
@@ -584,65 +902,312 @@ void SentenceTranslator::fill_span2rules_with_AXBXC_rule()
 }
 
 /**************************************************************************************
- 1. 函数功能: 处理glue规则
+ 1. 函数功能: 初始化glue规则模板
  2. 入口参数: 无
  3. 出口参数: 无
- 4. 算法简介: 按照第一个非终结符的长度遍历所有可能的pattern
+ 4. 算法简介: glue规则不再按切分位置逐条加入span2rules, 而是在处理句子前缀跨度时由
+              add_glue_cands_to_pq从左到右枚举切分位置, glue候选只引用模板的目标端
 ************************************************************************************* */
-void SentenceTranslator::fill_span2rules_with_glue_rule()
+void SentenceTranslator::init_glue_rule()
 {
 	vector<int> ids_X1X2 = {src_nt_id,src_nt_id};
 	vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_X1X2,0);
+	glue_rule.src_ids = ids_X1X2;
+	glue_rule.tgt_rule = &((*matched_rules_for_prefixes.back()).at(0));
+	glue_rule.tgt_rule_rank = 0;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 对句子前缀跨度, 用glue规则连接更短的前缀和紧随其后的跨度, 生成初始候选并加入candpq_glue
+ 2. 入口参数: 跨度的起始位置以及跨度的长度(实际为长度减1)
+ 3. 出口参数: 更新后的candpq_glue
+ 4. 算法简介: 从左到右的单调动态规划, 每个结束位置的前缀候选列表就是更短前缀跨度的
+              span2cands, 当前前缀由某个结束位置的前缀候选接上一个跨度的候选得到;
+              每个切分位置先加入两侧最好候选的组合, 之后由add_glue_neighbours_to_pq
+              沿两侧的排名扩展, 不经过立方体剪枝的规则和重复集合, 只用glue_visited
+              记录已经生成的(切分位置, 前缀排名, 后缀排名)
+************************************************************************************* */
+void SentenceTranslator::add_glue_cands_to_pq(const size_t beg,const size_t span,Candpq &candpq_glue)
+{
+    if (sen_len_of_beg.at(beg) < (int)span)                         //不是句子前缀跨度
+        return;
+    glue_visited.clear();
+    for (int len_X1=0;len_X1<span;len_X1++)                          //glue pattern的跨度不受规则最大跨度RULE_LEN_MAX的限制，可以延伸到句尾
+    {
+        generate_glue_cand_and_add_to_pq(beg,span,len_X1,0,0,candpq_glue);
+    }
+}
 
+/**************************************************************************************
+ 1. 函数功能: 用前缀(beg,len_X1)中第rank_x1个候选和其后跨度中第rank_x2个候选生成glue候选
+ 2. 入口参数: 前缀跨度的起始位置和长度, 第一个子跨度的长度, 两个子候选的排名
+ 3. 出口参数: 更新后的candpq_glue
+ 4. 算法简介: 任意一侧没有对应排名的候选时直接返回(例如剩余部分超出规则最大跨度);
+              候选的applied_rule只设置跨度和glue目标端, 源端固定为X1 X2, 不复制规则源端序列
+************************************************************************************* */
+void SentenceTranslator::generate_glue_cand_and_add_to_pq(const size_t beg,const size_t span,int len_X1,int rank_x1,int rank_x2,Candpq &candpq_glue)
+{
+    uint64_t key = (uint64_t)len_X1<<42 | (uint64_t)rank_x1<<21 | (uint64_t)rank_x2;
+    if (glue_visited.insert(key).second == false)
+        return;
+    int len_X2 = span-len_X1-1;
+    if (span2cands.contains(beg+len_X1+1,len_X2) == false)
+        return;
+    CandBeam &prefix_cands = span2cands(beg,len_X1);
+    CandBeam &next_cands = span2cands(beg+len_X1+1,len_X2);
+    if (prefix_cands.size() <= rank_x1 || next_cands.size() <= rank_x2)
+        return;
+
+    Cand *cand = new Cand;
+    Rule &rule = cand->applied_rule;
+    rule.span = make_pair(beg,span);
+    rule.span_x1 = make_pair(beg,len_X1);
+    rule.span_x2 = make_pair(beg+len_X1+1,len_X2);
+    rule.tgt_rule = glue_rule.tgt_rule;
+    update_cand_members(cand,rule,rank_x1,rank_x2,prefix_cands.at(rank_x1),next_cands.at(rank_x2));
+    if (para.LAZY_CUBE == true)
+    {
+        candpq_glue.push(cand);
+        return;
+    }
+    pending_cands.push_back(cand);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 将glue候选的邻居加入candpq_glue
+ 2. 入口参数: 从candpq_glue中取出的glue候选
+ 3. 出口参数: 更新后的candpq_glue
+ 4. 算法简介: 切分位置不变, 前缀候选或后缀候选的排名加1; glue规则只有一个目标端,
+              没有规则维度的邻居
+************************************************************************************* */
+void SentenceTranslator::add_glue_neighbours_to_pq(Cand *cur_cand, Candpq &candpq_glue)
+{
+    const Rule &rule = cur_cand->applied_rule;
+    generate_glue_cand_and_add_to_pq(rule.span.first,rule.span.second,rule.span_x1.second,cur_cand->rank_x1+1,cur_cand->rank_x2,candpq_glue);
+    generate_glue_cand_and_add_to_pq(rule.span.first,rule.span.second,rule.span_x1.second,cur_cand->rank_x1,cur_cand->rank_x2+1,candpq_glue);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 获取规则的源端序列
+ 2. 入口参数: 规则
+ 3. 出口参数: 源端符号id序列
+ 4. 算法简介: glue候选不保存源端序列, 返回glue规则模板的X1 X2
+************************************************************************************* */
+const vector<int>& SentenceTranslator::get_rule_src_ids(const Rule &rule)
+{
+    if (rule.tgt_rule != NULL && rule.tgt_rule->rule_type == 4)
+        return glue_rule.src_ids;
+    return rule.src_ids;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 粗粒度解码, 剪掉完整模型解码时不太可能用到的规则和跨度
+ 2. 入口参数: 无
+ 3. 出口参数: 无
+ 4. 算法简介: 粗粒度模型只使用规则得分以及规则内部的语言模型估计得分, 不计算nnjm和跨越
+ 			  规则边界的语言模型得分, 因此没有状态, 可以精确计算每个跨度的inside和
+ 			  outside得分:
+ 			  a) 自底向上计算每个跨度的最好inside得分, 短语规则和hiero规则取最大值
+ 			  b) 以句子跨度为根, 自顶向下计算每个跨度的最好outside得分
+ 			  c) 规则的最大边际得分为父跨度的outside得分、规则得分以及子跨度inside得分之和,
+ 			     比所在句子的最好得分低COARSE_THRESHOLD以上的规则从span2rules中删除,
+ 			     最大边际得分过低的跨度将span2validflag设为false, 不再生成任何候选;
+ 			     glue规则不在span2rules中, 只参与inside和outside得分的计算
+************************************************************************************* */
+void SentenceTranslator::prune_span2rules_with_coarse_pass()
+{
+    const double minus_inf = -numeric_limits<double>::infinity();
+    Chart<double,CHART_ROW_MAX> inside, outside;
+    Chart<vector<double>,CHART_ROW_MAX> rule_scores;
+    inside.init(sen_spans,src_sen_len);
+    inside.fill(minus_inf);
+    outside.init(sen_spans,src_sen_len);
+    outside.fill(minus_inf);
+    rule_scores.init(sen_spans,src_sen_len);
+    for (size_t beg=0;beg<src_sen_len;beg++)
+    {
+        vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(src_wids,beg);
+        for (size_t span=0;span<matched_rules_for_prefixes.size();span++)
+        {
+            if (is_valid_span(beg,span) == false)
+                continue;
+            if (matched_rules_for_prefixes.at(span) == NULL)
+            {
+                if (span == 0)                                              //OOV候选, 与完整模型一样加上UNK的语言模型得分
+                {
+                    inside(beg,span) = feature_weight.rule_num + feature_weight.len + feature_weight.lm*get_rule_lm_estimate(NULL);
+                }
+                continue;
+            }
+            for (auto &tgt_rule : *matched_rules_for_prefixes.at(span))
+            {
+                inside(beg,span) = max(inside(beg,span),get_coarse_rule_score(&tgt_rule));
+            }
+        }
+    }
+
+    double glue_score = get_coarse_rule_score(glue_rule.tgt_rule);
+    for (size_t span=1;span<src_sen_len;span++)
+    {
+        for (size_t beg=0;beg+span<src_sen_len;beg++)
+        {
+            if (is_valid_span(beg,span) == false)
+                continue;
+            for (auto &rule : span2rules(beg,span))
+            {
+                double rule_score = minus_inf;
+                for (auto &tgt_rule : *rule.tgt_rules)
+                {
+                    rule_score = max(rule_score,get_coarse_rule_score(&tgt_rule));
+                }
+                rule_scores(beg,span).push_back(rule_score);
+                double score = rule_score + inside(rule.span_x1.first,rule.span_x1.second);
+                if (rule.tgt_rule->rule_type >= 2)
+                {
+                    score += inside(rule.span_x2.first,rule.span_x2.second);
+                }
+                inside(beg,span) = max(inside(beg,span),score);
+            }
+            if (sen_len_of_beg.at(beg) >= (int)span)                      //句子前缀跨度上的glue规则
+            {
+                for (size_t len_X1=0;len_X1<span;len_X1++)
+                {
+                    if (inside.contains(beg+len_X1+1,span-len_X1-1) == false)
+                        continue;
+                    double score = glue_score + inside(beg,len_X1) + inside(beg+len_X1+1,span-len_X1-1);
+                    inside(beg,span) = max(inside(beg,span),score);
+                }
+            }
+        }
+    }
+
+    vector<double> sen_best_scores(src_sen_len,minus_inf);                  //每个位置所在句子的最好得分
     for (auto &sen_span : sen_spans)
     {
-        int sen_beg = sen_span.first;
-        int sen_len = sen_span.second;
-        for (int len_X1X2=1;len_X1X2<=sen_len;len_X1X2++)               //glue pattern的跨度不受规则最大跨度RULE_LEN_MAX的限制，可以延伸到句尾
+        outside(sen_span.first,sen_span.second) = 0.0;
+        for (int i=sen_span.first;i<=sen_span.first+sen_span.second;i++)
+        {
+            sen_best_scores.at(i) = inside(sen_span.first,sen_span.second);
+        }
+    }
+    for (int span=src_sen_len-1;span>=1;span--)
+    {
+        for (size_t beg=0;beg+span<src_sen_len;beg++)
         {
-            for (int len_X1=0;len_X1<len_X1X2;len_X1++)
+            if (is_valid_span(beg,span) == false || outside(beg,span) == minus_inf)
+                continue;
+            vector<Rule> &rules = span2rules(beg,span);
+            for (size_t i=0;i<rules.size();i++)
             {
-                Rule rule;
-                rule.span = make_pair(sen_beg,len_X1X2);
-                rule.src_ids = ids_X1X2;
-                rule.tgt_rule = &((*matched_rules_for_prefixes.back()).at(0));
-                rule.tgt_rule_rank = 0;
-                rule.span_x1 = make_pair(sen_beg,len_X1);
-                rule.span_x2 = make_pair(sen_beg+len_X1+1,len_X1X2-len_X1-1);
-                span2rules.at(sen_beg).at(len_X1X2).push_back(rule);
+                double score = outside(beg,span) + rule_scores(beg,span).at(i);
+                double &outside_x1 = outside(rules.at(i).span_x1.first,rules.at(i).span_x1.second);
+                if (rules.at(i).tgt_rule->rule_type >= 2)
+                {
+                    double &outside_x2 = outside(rules.at(i).span_x2.first,rules.at(i).span_x2.second);
+                    double inside_x1 = inside(rules.at(i).span_x1.first,rules.at(i).span_x1.second);
+                    double inside_x2 = inside(rules.at(i).span_x2.first,rules.at(i).span_x2.second);
+                    outside_x1 = max(outside_x1,score+inside_x2);
+                    outside_x2 = max(outside_x2,score+inside_x1);
+                }
+                else
+                {
+                    outside_x1 = max(outside_x1,score);
+                }
+            }
+            if (sen_len_of_beg.at(beg) >= span)
+            {
+                for (int len_X1=0;len_X1<span;len_X1++)
+                {
+                    if (inside.contains(beg+len_X1+1,span-len_X1-1) == false)
+                        continue;
+                    double score = outside(beg,span) + glue_score;
+                    double &outside_x1 = outside(beg,len_X1);
+                    double &outside_x2 = outside(beg+len_X1+1,span-len_X1-1);
+                    outside_x1 = max(outside_x1,score+inside(beg+len_X1+1,span-len_X1-1));
+                    outside_x2 = max(outside_x2,score+inside(beg,len_X1));
+                }
             }
         }
     }
+
+    for (size_t beg=0;beg<src_sen_len;beg++)
+    {
+        for (size_t span=0;span<span2validflag.row_size(beg);span++)
+        {
+            if (is_valid_span(beg,span) == false || sen_best_scores.at(beg) == minus_inf)
+                continue;
+            double threshold = sen_best_scores.at(beg) - para.COARSE_THRESHOLD;
+            if (inside(beg,span) + outside(beg,span) < threshold)
+            {
+                span2validflag(beg,span) = false;
+                vector<Rule>().swap(span2rules(beg,span));
+                continue;
+            }
+            vector<Rule> kept_rules;
+            vector<Rule> &rules = span2rules(beg,span);
+            for (size_t i=0;i<rules.size();i++)
+            {
+                double score = outside(beg,span) + rule_scores(beg,span).at(i)
+                               + inside(rules.at(i).span_x1.first,rules.at(i).span_x1.second);
+                if (rules.at(i).tgt_rule->rule_type >= 2)
+                {
+                    score += inside(rules.at(i).span_x2.first,rules.at(i).span_x2.second);
+                }
+                if (score >= threshold)
+                {
+                    kept_rules.push_back(rules.at(i));
+                }
+            }
+            rules.swap(kept_rules);
+        }
+    }
+}
+
+//粗粒度模型中规则的得分, 包括翻译概率、规则内部的语言模型估计得分、长度以及规则数
+double SentenceTranslator::get_coarse_rule_score(TgtRule *tgt_rule)
+{
+    int glue_num = tgt_rule->rule_type == 4 ? 1 : 0;
+    return tgt_rule->score + feature_weight.lm*get_rule_lm_estimate(tgt_rule) + feature_weight.len*tgt_rule->word_num
+           + feature_weight.rule_num*1 + feature_weight.glue*glue_num;
 }
 
 /**************************************************************************************
  1. 函数功能: 对给定的pattern以及该pattern对应的span，将匹配到的规则加入span2rules中
  2. 入口参数: 无
  3. 出口参数: 无
- 4. 算法简介: 略
+ 4. 算法简介: 每个pattern及其变量跨度构成一个立方体, 只加入得分最高的目标端,
+              其余目标端在立方体剪枝时作为规则维度的邻居逐步扩展
 ************************************************************************************* */
 void SentenceTranslator::fill_span2rules_with_matched_rules(vector<TgtRule> &matched_rules,vector<int> &src_ids,pair<int,int> span,pair<int,int> span_src_x1,pair<int,int> span_src_x2)
 {
-    if (span2validflag[span.first][span.second] == false)
+    if (is_valid_span(span.first,span.second) == false)
         return;
-	for (int i=0;i<matched_rules.size();i++)
+	Rule rule;
+	rule.span = span;
+	rule.src_ids = src_ids;
+	rule.tgt_rules = &matched_rules;
+	rule.span_x1 = span_src_x1;
+	rule.span_x2 = span_src_x2;
+	set_rule_rank(rule,0);
+	span2rules(span.first,span.second).push_back(rule);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 将规则的目标端设置为源端相同的所有目标端中的第rank个
+ 2. 入口参数: 规则, 目标端的排名
+ 3. 出口参数: 无
+ 4. 算法简介: 规则中的span_x1和span_x2按照目标端非终结符的顺序存放, 改变目标端后,
+              如果新旧目标端的非终结符顺序不同(逆序hiero规则), 则交换两个变量的跨度
+************************************************************************************* */
+void SentenceTranslator::set_rule_rank(Rule &rule, int rank)
+{
+	bool old_inverted = rule.tgt_rule != NULL && rule.tgt_rule->rule_type == 3;
+	rule.tgt_rule = &rule.tgt_rules->at(rank);
+	rule.tgt_rule_rank = rank;
+	bool new_inverted = rule.tgt_rule->rule_type == 3;
+	if (old_inverted != new_inverted)
 	{
-		Rule rule;
-        rule.span = span;
-		rule.src_ids = src_ids;
-		rule.tgt_rule = &matched_rules.at(i);
-		rule.tgt_rule_rank = i;
-		if (matched_rules.at(i).rule_type == 3)
-		{
-			rule.span_x1 = span_src_x2;
-			rule.span_x2 = span_src_x1;
-		}
-		else
-		{
-			rule.span_x1 = span_src_x1;
-			rule.span_x2 = span_src_x2;
-		}
-		span2rules.at(span.first).at(span.second).push_back(rule);
+		swap(rule.span_x1,rule.span_x2);
 	}
 }
 
@@ -664,43 +1229,259 @@ string SentenceTranslator::words_to_str(vector<int> wids, int drop_oov)
 		return output;
 }
 
+/**************************************************************************************
+ 1. 函数功能: 获取每个句子的n-best译文及其特征值, 用于调参
+ 2. 入口参数: 无
+ 3. 出口参数: 每个句子的n-best列表
+ 4. 算法简介: 在保留了被重组候选的超图上惰性抽取k-best推导, 句子跨度CandBeam中的每个
+ 			  候选都是一个根节点, 用优先级队列按得分合并所有根节点的推导列表;
+ 			  目标端相同的推导只保留得分最高的一个, 枚举的推导数不超过
+ 			  NBEST_NUM*KBEST_DISTINCT_FACTOR
+************************************************************************************* */
 vector<vector<TuneInfo> > SentenceTranslator::get_tune_info()
 {
 	vector<vector<TuneInfo> > nbest_tune_info_list;
-    int offset = -1;
     for (auto &sen_span : sen_spans)
     {
-        offset++;
         vector<TuneInfo> nbest_tune_info;
-        CandBeam &candbeam = span2cands.at(sen_span.first).at(sen_span.second);
-        for (size_t i=0;i< (candbeam.size()<para.NBEST_NUM?candbeam.size():para.NBEST_NUM);i++)
+        CandBeam &candbeam = span2cands(sen_span.first,sen_span.second);
+        KbestExtractor kbest_extractor;
+        priority_queue<pair<double,pair<int,size_t> > > root_derivs;        //(得分,(根节点在CandBeam中的位置,推导排名))
+        for (size_t i=0;i<candbeam.size();i++)
+        {
+            const Deriv *deriv = kbest_extractor.get_kth_deriv(candbeam.at(i),0);
+            if (deriv != NULL)
+            {
+                root_derivs.push(make_pair(deriv->score,make_pair(i,0)));
+            }
+        }
+        set<vector<int> > seen_tgt_wids;
+        size_t deriv_num = 0;
+        while (!root_derivs.empty() && nbest_tune_info.size() < para.NBEST_NUM && deriv_num < para.NBEST_NUM*KBEST_DISTINCT_FACTOR)
         {
-            TuneInfo tune_info;
-            tune_info.translation = words_to_str(candbeam.at(i)->tgt_wids,0);
-            for (size_t j=0;j<PROB_NUM;j++)
+            int root_idx = root_derivs.top().second.first;
+            Cand *root = candbeam.at(root_idx);
+            size_t k = root_derivs.top().second.second;
+            root_derivs.pop();
+            deriv_num++;
+            const Deriv *deriv = kbest_extractor.get_kth_deriv(root,k);
+            vector<int> tgt_wids;
+            append_deriv_tgt_wids(deriv,tgt_wids);
+            if (seen_tgt_wids.insert(tgt_wids).second)
+            {
+                TuneInfo tune_info;
+                tune_info.translation = words_to_str(tgt_wids,0);
+                tune_info.feature_values = get_deriv_feature_values(deriv);
+                tune_info.total_score = deriv->score;
+                nbest_tune_info.push_back(tune_info);
+            }
+            const Deriv *next_deriv = kbest_extractor.get_kth_deriv(root,k+1);
+            if (next_deriv != NULL)
             {
-                tune_info.feature_values.push_back(candbeam.at(i)->trans_probs.at(j));
+                root_derivs.push(make_pair(next_deriv->score,make_pair(root_idx,k+1)));
             }
-            tune_info.feature_values.push_back(candbeam.at(i)->lm_prob);
-            tune_info.feature_values.push_back(candbeam.at(i)->tgt_word_num);
-            tune_info.feature_values.push_back(candbeam.at(i)->rule_num);
-            tune_info.feature_values.push_back(candbeam.at(i)->glue_num);
-            tune_info.feature_values.push_back(candbeam.at(i)->nnjm_prob);
-            tune_info.total_score = candbeam.at(i)->score;
-            nbest_tune_info.push_back(tune_info);
         }
         nbest_tune_info_list.push_back(nbest_tune_info);
     }
 	return nbest_tune_info_list;
 }
 
+//按照推导回溯目标端id序列, 与append_tgt_wids相同, 但子节点使用推导中指定的子推导
+void SentenceTranslator::append_deriv_tgt_wids(const Deriv *deriv, vector<int> &tgt_wids)
+{
+    Cand *cand = deriv->edge;
+    if (cand->applied_rule.tgt_rule == NULL)                              //OOV候选
+    {
+        tgt_wids.push_back(0 - src_wids.at(cand->span.first));
+        return;
+    }
+    int nt_num = 1;
+    for (auto tgt_wid : cand->applied_rule.tgt_rule->wids)
+    {
+        if (tgt_wid == tgt_nt_id)
+        {
+            append_deriv_tgt_wids(nt_num == 1 ? deriv->deriv_x1 : deriv->deriv_x2,tgt_wids);
+            nt_num++;
+        }
+        else
+        {
+            tgt_wids.push_back(tgt_wid);
+        }
+    }
+}
+
+vector<double> SentenceTranslator::get_cand_feature_values(Cand *cand)
+{
+    vector<double> feature_values(cand->trans_probs.begin(),cand->trans_probs.end());
+    feature_values.push_back(cand->lm_prob);
+    feature_values.push_back(cand->tgt_word_num);
+    feature_values.push_back(cand->rule_num);
+    feature_values.push_back(cand->glue_num);
+    feature_values.push_back(cand->nnjm_prob);
+    return feature_values;
+}
+
+//入边的特征值中包含子节点最好推导的特征值, 将其替换为所用子推导的特征值
+vector<double> SentenceTranslator::get_deriv_feature_values(const Deriv *deriv)
+{
+    vector<double> feature_values = get_cand_feature_values(deriv->edge);
+    vector<pair<const Deriv*,Cand*> > children = {make_pair(deriv->deriv_x1,deriv->edge->child_x1),make_pair(deriv->deriv_x2,deriv->edge->child_x2)};
+    for (auto &child : children)
+    {
+        if (child.first == NULL || (child.first->edge == child.second && child.first->rank_x1 == 0 && child.first->rank_x2 == 0))
+            continue;                                                  //子节点使用的是其最好推导, 特征值不变
+        vector<double> deriv_values = get_deriv_feature_values(child.first);
+        vector<double> node_values = get_cand_feature_values(child.second);
+        for (size_t i=0;i<feature_values.size();i++)
+        {
+            feature_values.at(i) += deriv_values.at(i) - node_values.at(i);
+        }
+    }
+    return feature_values;
+}
+
+template <class T>
+static void append_binary(string &blob, T value)
+{
+    blob.append((const char*)&value,sizeof(T));
+}
+
+/**************************************************************************************
+ 1. 函数功能: 将每个句子剪枝后的搜索空间序列化为二进制超图, 格式见translator.h
+ 2. 入口参数: 无
+ 3. 出口参数: 每个句子的超图(不含句子编号)
+ 4. 算法简介: 句子跨度CandBeam中的候选为根节点, 从根节点出发深度优先遍历, 节点的入边为
+ 			  该候选本身以及被它重组掉的候选, 后序编号保证子节点在父节点之前;
+ 			  不能从根节点到达的候选对后续处理没有用处, 不输出
+************************************************************************************* */
+vector<string> SentenceTranslator::get_hypergraphs()
+{
+    vector<string> hypergraphs;
+    for (auto &sen_span : sen_spans)
+    {
+        CandBeam &candbeam = span2cands(sen_span.first,sen_span.second);
+        unordered_map<Cand*,int> node_ids;
+        string nodes, edges;
+        int edge_num = 0;
+        vector<int> roots;
+        for (size_t i=0;i<candbeam.size();i++)
+        {
+            roots.push_back(add_node_to_hypergraph(candbeam.at(i),node_ids,nodes,edges,edge_num));
+        }
+        string hypergraph;
+        append_binary(hypergraph,(int)node_ids.size());
+        append_binary(hypergraph,edge_num);
+        append_binary(hypergraph,(int)roots.size());
+        for (auto root : roots)
+        {
+            append_binary(hypergraph,root);
+        }
+        hypergraph += nodes;
+        hypergraph += edges;
+        hypergraphs.push_back(hypergraph);
+    }
+    return hypergraphs;
+}
+
+//递归加入节点及其所有入边, 返回节点编号
+int SentenceTranslator::add_node_to_hypergraph(Cand *node, unordered_map<Cand*,int> &node_ids, string &nodes, string &edges, int &edge_num)
+{
+    auto it = node_ids.find(node);
+    if (it != node_ids.end())
+        return it->second;
+    vector<Cand*> in_edges = {node};
+    in_edges.insert(in_edges.end(),node->recombined_cands.begin(),node->recombined_cands.end());
+    for (auto edge : in_edges)
+    {
+        if (edge->child_x1 != NULL)
+        {
+            add_node_to_hypergraph(edge->child_x1,node_ids,nodes,edges,edge_num);
+        }
+        if (edge->child_x2 != NULL)
+        {
+            add_node_to_hypergraph(edge->child_x2,node_ids,nodes,edges,edge_num);
+        }
+    }
+    int node_id = node_ids.size();
+    node_ids.insert(make_pair(node,node_id));
+    append_binary(nodes,node->span.first);
+    append_binary(nodes,node->span.second);
+    append_binary(nodes,(float)node->score);
+    for (auto edge : in_edges)
+    {
+        add_edge_to_hypergraph(edge,node_id,node_ids,edges);
+        edge_num++;
+    }
+    return node_id;
+}
+
+//边的局部特征值为入边的特征值减去尾节点(即子节点最好推导)的特征值
+void SentenceTranslator::add_edge_to_hypergraph(Cand *edge, int head, unordered_map<Cand*,int> &node_ids, string &edges)
+{
+    append_binary(edges,head);
+    vector<Cand*> tails;
+    if (edge->child_x1 != NULL)
+    {
+        tails.push_back(edge->child_x1);
+    }
+    if (edge->child_x2 != NULL)
+    {
+        tails.push_back(edge->child_x2);
+    }
+    append_binary(edges,(char)tails.size());
+    vector<double> feature_values = get_cand_feature_values(edge);
+    for (auto tail : tails)
+    {
+        append_binary(edges,node_ids.at(tail));
+        vector<double> tail_values = get_cand_feature_values(tail);
+        for (size_t i=0;i<feature_values.size();i++)
+        {
+            feature_values.at(i) -= tail_values.at(i);
+        }
+    }
+    for (auto v : feature_values)
+    {
+        append_binary(edges,(float)v);
+    }
+    const Rule &rule = edge->applied_rule;
+    if (rule.tgt_rule == NULL)                                                 //OOV候选
+    {
+        int src_wid = src_wids.at(edge->span.first);
+        append_binary(edges,(short)1);
+        append_binary(edges,src_wid);
+        append_binary(edges,(short)1);
+        append_binary(edges,HYPERGRAPH_OOV_BASE-src_wid);
+        return;
+    }
+    const vector<int> &src_ids = get_rule_src_ids(rule);
+    append_binary(edges,(short)src_ids.size());
+    for (auto src_id : src_ids)
+    {
+        append_binary(edges,src_id);
+    }
+    append_binary(edges,(short)rule.tgt_rule->wids.size());
+    int nt_num = 1;
+    for (auto tgt_wid : rule.tgt_rule->wids)
+    {
+        if (tgt_wid == tgt_nt_id)
+        {
+            append_binary(edges,0-nt_num);
+            nt_num++;
+        }
+        else
+        {
+            append_binary(edges,tgt_wid);
+        }
+    }
+}
+
 vector<vector<string> > SentenceTranslator::get_applied_rules()
 {
     vector<vector<string> > applied_rules_list;
     for (auto &sen_span : sen_spans)
     {
         vector<string> applied_rules;
-        Cand *best_cand = span2cands.at(sen_span.first).at(sen_span.second).top();
+        Cand *best_cand = span2cands(sen_span.first,sen_span.second).top();
         dump_rules(applied_rules,best_cand);
         applied_rules.push_back(" ||||| ");
         string src_sen;
@@ -742,7 +1523,7 @@ void SentenceTranslator::dump_rules(vector<string> &applied_rules, Cand *cand)
 		reverse(tgt_nts.begin(),tgt_nts.end());
 		reverse(children.begin(),children.end());
 	}
-	for (auto src_wid : cand->applied_rule.src_ids)
+	for (auto src_wid : get_rule_src_ids(cand->applied_rule))
 	{
 		if (src_wid == src_nt_id)
 		{
@@ -794,23 +1575,33 @@ void SentenceTranslator::dump_rules(vector<string> &applied_rules, Cand *cand)
 
 vector<string> SentenceTranslator::translate_sentence()
 {
-	for(size_t beg=0;beg<src_sen_len;beg++)
-	{
-		span2cands.at(beg).at(0).sort();		               //对列表中的候选进行排序
-	}
-	for (size_t span=1;span<src_sen_len;span++)
-	{
+    for (auto &sen_span : sen_spans)                    //在每个句子各自的chart上解码
+    {
+        size_t sen_beg = sen_span.first;
+        size_t sen_len = sen_span.second;
+        for(size_t beg=sen_beg;beg<=sen_beg+sen_len;beg++)
+        {
+            span2cands(beg,0).sort();		               //对列表中的候选进行排序
+            cube_stats.at(0).span_num++;
+            cube_stats.at(0).threshold_pruned_num += span2cands(beg,0).get_threshold_pruned_num();
+        }
+        for (size_t span=1;span<=sen_len;span++)
+        {
 //#pragma omp parallel for num_threads(para.SPAN_THREAD_NUM)
-		for(size_t beg=0;beg<src_sen_len-span;beg++)
-		{
-			generate_kbest_for_span(beg,span);
-			span2cands.at(beg).at(span).sort();
-		}
-	}
+            for(size_t beg=sen_beg;beg+span<=sen_beg+sen_len;beg++)
+            {
+                if (is_valid_span(beg,span) == false)   //不在chart中的跨度没有对应的元素, 不能访问span2cands(beg,span)
+                    continue;
+                generate_kbest_for_span(beg,span);
+                span2cands(beg,span).sort();
+                cube_stats.at(span).threshold_pruned_num += span2cands(beg,span).get_threshold_pruned_num();
+            }
+        }
+    }
     vector<string> output_sens;
     for (auto &sen_span : sen_spans)
     {
-        output_sens.push_back(words_to_str(span2cands.at(sen_span.first).at(sen_span.second).top()->tgt_wids,para.DROP_OOV));
+        output_sens.push_back(words_to_str(get_tgt_wids(span2cands(sen_span.first,sen_span.second).top()),para.DROP_OOV));
     }
     return output_sens;
 }
@@ -823,43 +1614,76 @@ vector<string> SentenceTranslator::translate_sentence()
 ************************************************************************************* */
 void SentenceTranslator::generate_kbest_for_span(const size_t beg,const size_t span)
 {
-    if (span2validflag[beg][span] == false)
+    if (is_valid_span(beg,span) == false)
         return;
 	Candpq candpq_merge;			    //优先级队列,用来临时存储通过合并得到的候选
-	set<vector<int> > duplicate_set;	//用来记录候选是否已经被加入candpq_merge中
+	Candpq candpq_glue;			        //句子前缀跨度上glue动态规划生成的候选, 与candpq_merge一起按得分出队
+	duplicate_set.clear();	            //用来记录候选是否已经被加入candpq_merge中
 
-	//对于当前跨度匹配到的每一条规则,取出非终结符对应的跨度中的最好候选,将合并得到的候选加入candpq_merge
-	for(auto &rule : span2rules.at(beg).at(span))
+	//对于当前跨度的每个立方体(规则源端及变量跨度相同),取得分最高的目标端以及非终结符对应的跨度中的最好候选,将合并得到的候选加入candpq_merge
+	for(auto &rule : span2rules(beg,span))
 	{
 		generate_cand_with_rule_and_add_to_pq(rule,0,0,candpq_merge,duplicate_set);
 	}
+	score_pending_cands_and_add_to_pq(candpq_merge);
+	add_glue_cands_to_pq(beg,span,candpq_glue);
+	score_pending_cands_and_add_to_pq(candpq_glue);
 
 	//立方体剪枝,每次从candpq_merge中取出最好的候选加入span2cands中,并将该候选的邻居加入candpq_merge中
+	//打开CUBE_EARLY_STOP时, 如果连续取出的CUBE_EARLY_STOP个候选都无法进入列表, 则认为之后的候选也无法进入, 提前结束
+	//由于语言模型和nnjm得分不满足单调性, 只看一个候选就结束会明显降低搜索质量
+	CandBeam &candbeam = span2cands(beg,span);
+	CubeStats &stats = cube_stats.at(span);
+	stats.span_num++;
+	size_t rejected_num = 0;
 	int added_cand_num = 0;
 	while (added_cand_num<para.CUBE_SIZE)
 	{
-		if (candpq_merge.empty()==true)
+		if (candpq_merge.empty()==true && candpq_glue.empty()==true)
 			break;
-		Cand* best_cand = candpq_merge.top();
-		candpq_merge.pop();
-        bool flag = false;
-        for (auto &sen_span : sen_spans)
-        {
-            if (beg == sen_span.first && span == sen_span.second)
-            {
-                flag = true;
-                break;
-            }
-        }
-		if (flag == true)
+		bool is_glue = candpq_merge.empty()==true || (candpq_glue.empty()==false && candpq_glue.top()->score > candpq_merge.top()->score);
+		Candpq &candpq = is_glue ? candpq_glue : candpq_merge;
+		Cand* best_cand = candpq.top();
+		candpq.pop();
+		stats.pop_num++;
+		if (best_cand->is_scored == false)         //延迟打分的候选出队时才计算完整得分, 如果得分低于队首的候选则重新入队
+		{
+			complete_cand_members(&best_cand,1);
+			double next_score = -numeric_limits<double>::infinity();
+			if (candpq_merge.empty() == false)
+				next_score = candpq_merge.top()->score;
+			if (candpq_glue.empty() == false)
+				next_score = max(next_score,candpq_glue.top()->score);
+			if (best_cand->score < next_score)
+			{
+				candpq.push(best_cand);
+				continue;
+			}
+		}
+		//句子级跨度先加上句首句尾的语言模型得分, 使提前结束的判断与列表中候选的最终得分可比
+		if (sen_len_of_beg.at(beg) == span)
 		{
 			double increased_lm_prob = lm_model->cal_final_increased_lm_score(best_cand);
 			best_cand->lm_prob += increased_lm_prob;
 			best_cand->score += feature_weight.lm*increased_lm_prob;
 		}
-		
-        add_neighbours_to_pq(best_cand,candpq_merge,duplicate_set);
-		span2cands.at(beg).at(span).add(best_cand,para.BEAM_SIZE);
+		if (para.CUBE_EARLY_STOP > 0)
+		{
+			rejected_num = candbeam.can_enter(best_cand->score,para.BEAM_SIZE) ? 0 : rejected_num+1;
+			if (rejected_num >= para.CUBE_EARLY_STOP)
+			{
+				stats.early_stop_num++;
+				delete best_cand;
+				break;
+			}
+		}
+
+        if (is_glue)
+            add_glue_neighbours_to_pq(best_cand,candpq_glue);
+        else
+            add_neighbours_to_pq(best_cand,candpq_merge,duplicate_set);
+        score_pending_cands_and_add_to_pq(candpq);
+		candbeam.add(best_cand,para.BEAM_SIZE,keep_recombined);
 		added_cand_num++;
 	}
 
@@ -868,38 +1692,61 @@ void SentenceTranslator::generate_kbest_for_span(const size_t beg,const size_t s
 		delete candpq_merge.top();
 		candpq_merge.pop();
 	}
+	while(!candpq_glue.empty())
+	{
+		delete candpq_glue.top();
+		candpq_glue.pop();
+	}
 }
 
 /**************************************************************************************
  1. 函数功能: 合并两个子候选并将生成的候选加入candpq_merge中
  2. 入口参数: 两个子候选,两个子候选的排名
  3. 出口参数: 更新后的candpq_merge
- 4. 算法简介: 顺序以及逆序合并两个子候选
+ 4. 算法简介: 顺序以及逆序合并两个子候选; 非延迟打分时候选先放入pending_cands,
+              由score_pending_cands_and_add_to_pq批量打分后入队
 ************************************************************************************* */
-void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int rank_x1,int rank_x2,Candpq &candpq_merge,set<vector<int> > &duplicate_set)
+void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int rank_x1,int rank_x2,Candpq &candpq_merge,DuplicateSet &duplicate_set)
 {
     //key包含两个变量在源端的span（用来检查规则源端是否相同），规则目标端在源端相同的所有目标端的排名（检查规则目标端是否相同）
     //以及子候选在两个变量中的排名（检查子候选是否相同）
-    vector<int> key = {rule.span_x1.first,rule.span_x1.second,rule.span_x2.first,rule.span_x2.second,rule.tgt_rule_rank,rank_x1,rank_x2};
-    if (duplicate_set.insert(key).second == false)
+    if (duplicate_set.find_or_insert(CubeKey(rule,rank_x1,rank_x2)) == true)
         return;
 
-    if (span2cands.at(rule.span_x1.first).at(rule.span_x1.second).size() <= rank_x1)
+    if (span2cands(rule.span_x1.first,rule.span_x1.second).size() <= rank_x1)
         return;
-    if (rule.tgt_rule->rule_type >=2 && span2cands.at(rule.span_x2.first).at(rule.span_x2.second).size() <= rank_x2)
+    if (rule.tgt_rule->rule_type >=2 && span2cands(rule.span_x2.first,rule.span_x2.second).size() <= rank_x2)
         return;
 
-    Cand *cand_x1 = span2cands.at(rule.span_x1.first).at(rule.span_x1.second).at(rank_x1);
-    Cand *cand_x2 = rule.tgt_rule->rule_type >= 2 ? span2cands.at(rule.span_x2.first).at(rule.span_x2.second).at(rank_x2) : null_cand;
+    Cand *cand_x1 = span2cands(rule.span_x1.first,rule.span_x1.second).at(rank_x1);
+    Cand *cand_x2 = rule.tgt_rule->rule_type >= 2 ? span2cands(rule.span_x2.first,rule.span_x2.second).at(rank_x2) : null_cand;
     Cand *cand = new Cand;
+    cand->applied_rule = rule;
     update_cand_members(cand,rule,rank_x1,rank_x2,cand_x1,cand_x2);
-    candpq_merge.push(cand);
+    if (para.LAZY_CUBE == true)
+    {
+        candpq_merge.push(cand);
+        return;
+    }
+    pending_cands.push_back(cand);
+}
+
+//对等待打分的候选批量计算得分, 然后按生成的顺序加入candpq_merge
+void SentenceTranslator::score_pending_cands_and_add_to_pq(Candpq &candpq_merge)
+{
+    if (pending_cands.empty())
+        return;
+    complete_cand_members(pending_cands.data(),pending_cands.size());
+    for (auto cand : pending_cands)
+    {
+        candpq_merge.push(cand);
+    }
+    pending_cands.clear();
 }
 
-void SentenceTranslator::update_cand_members(Cand* cand, Rule &rule, int rank_x1, int rank_x2, Cand* cand_x1, Cand* cand_x2)
+void SentenceTranslator::update_cand_members(Cand* cand, const Rule &rule, int rank_x1, int rank_x2, Cand* cand_x1, Cand* cand_x2)
 {
     cand->span = rule.span;
-    cand->applied_rule = rule;
     int glue_num = rule.tgt_rule->rule_type == 4 ? 1 : 0;
     cand->rule_num = cand_x1->rule_num + cand_x2->rule_num + 1;
     cand->glue_num = cand_x1->glue_num + cand_x2->glue_num + glue_num;
@@ -908,36 +1755,132 @@ void SentenceTranslator::update_cand_members(Cand* cand, Rule &rule, int rank_x1
     cand->child_x1 = cand_x1;
     cand->child_x2 = rule.tgt_rule->rule_type >= 2 ? cand_x2 : NULL;
     cand->tgt_word_num = cand_x1->tgt_word_num + cand_x2->tgt_word_num + rule.tgt_rule->word_num;
+    for (size_t i=0;i<PROB_NUM;i++)
+    {
+        cand->trans_probs.push_back(cand_x1->trans_probs.at(i) + cand_x2->trans_probs.at(i) + rule.tgt_rule->probs.at(i));
+    }
+    if (para.LAZY_CUBE == true)                 //延迟打分, 先用子候选得分、规则得分以及规则内部的语言模型估计得分排序
+    {
+        cand->is_scored = false;
+        cand->score = cand_x1->score + cand_x2->score + rule.tgt_rule->score + feature_weight.lm*get_rule_lm_estimate(rule.tgt_rule)
+            + feature_weight.rule_num*1 + feature_weight.glue*glue_num + feature_weight.len*rule.tgt_rule->word_num;
+    }
+}
 
-    cand->aligned_src_idx = get_aligned_src_idx(cand->span.first,*(rule.tgt_rule),cand_x1,cand_x2);
+/**************************************************************************************
+ 1. 函数功能: 计算一批候选的目标端单词序列、对齐信息以及语言模型和nnjm得分
+ 2. 入口参数: 已经设置好规则和子候选的候选数组, 候选个数
+ 3. 出口参数: 无
+ 4. 算法简介: 非延迟打分时在候选入队前对一批候选调用, 延迟打分时在候选出队时对单个候选调用;
+              先收集整批候选的nnjm查询并一起计算, 再批量计算语言模型得分, 使语言模型的内存访问可以重叠
+************************************************************************************* */
+void SentenceTranslator::complete_cand_members(Cand **cands, size_t cand_num)
+{
+    batch_nnjm_probs.resize(cand_num);
+    batch_lm_probs.resize(cand_num);
+    for (size_t i=0;i<cand_num;i++)
+    {
+        build_tgt_seq(cands[i],tgt_seq);
+        collect_nnjm_queries(cands[i],tgt_seq,i);
+        update_tgt_bound(cands[i],tgt_seq);
+    }
+    cal_collected_nnjm_scores(batch_nnjm_probs.data(),cand_num);
+    cal_increased_lm_scores_with_memo(cands,cand_num,batch_lm_probs.data());
+    for (size_t i=0;i<cand_num;i++)
+    {
+        Cand *cand = cands[i];
+        Rule &rule = cand->applied_rule;
+        Cand* cand_x1 = cand->child_x1;
+        Cand* cand_x2 = cand->child_x2 != NULL ? cand->child_x2 : null_cand;
+        int glue_num = rule.tgt_rule->rule_type == 4 ? 1 : 0;
+        double increased_nnjm_prob = batch_nnjm_probs[i];
+        double increased_lm_prob = batch_lm_probs[i];
+        cand->nnjm_prob = cand_x1->nnjm_prob + cand_x2->nnjm_prob + increased_nnjm_prob;
+        cand->lm_prob = cand_x1->lm_prob + cand_x2->lm_prob + increased_lm_prob;
+        cand->score = cand_x1->score + cand_x2->score + rule.tgt_rule->score + feature_weight.lm*increased_lm_prob
+            + feature_weight.rule_num*1 + feature_weight.glue*glue_num + feature_weight.len*rule.tgt_rule->word_num
+            + feature_weight.nnjm*increased_nnjm_prob;
+        cand->is_scored = true;
+    }
+}
 
-    int nt_num = 1; 							//表示第几个非终结符
-    for (auto tgt_wid : rule.tgt_rule->wids)
+/**************************************************************************************
+ 1. 函数功能: 计算一批候选的规则带来的语言模型得分增量, 并设置候选的语言模型状态
+ 2. 入口参数: 已经设置好规则和子候选的候选数组, 候选个数
+ 3. 出口参数: 每个候选的语言模型得分增量
+ 4. 算法简介: a) 同一立方体中的邻居共享规则, 被重组的子候选又具有相同的语言模型状态,
+                 因此以(规则目标端, 子候选状态的哈希值)为键缓存打分结果, 命中时不再查询KenLM
+              b) 未命中的候选每LM_PREFETCH_BATCH个一组交给语言模型批量打分, 打分结果加入备忘录;
+                 同一批中键相同的未命中候选只打分一次, 其余的直接复制打分结果和状态
+************************************************************************************* */
+void SentenceTranslator::cal_increased_lm_scores_with_memo(Cand **cands, size_t cand_num, double *increased_lm_probs)
+{
+    lm_miss_cands.clear();
+    lm_miss_indexes.clear();
+    lm_miss_slots.clear();
+    lm_miss_dups.clear();
+    for (size_t i=0;i<cand_num;i++)
     {
-        if (tgt_wid == tgt_nt_id)
+        Cand *cand = cands[i];
+        LmMemoKey key = get_lm_memo_key(cand);
+        lm_memo_query_num++;
+        auto it = lm_memo.find(key);
+        if (it != lm_memo.end())
         {
-            Cand* sub_cand = nt_num == 1 ? cand_x1 : cand_x2;
-            cand->tgt_wids.insert(cand->tgt_wids.end(),sub_cand->tgt_wids.begin(),sub_cand->tgt_wids.end());
-            cand->nnjm_ngram_score.insert(cand->nnjm_ngram_score.end(),sub_cand->nnjm_ngram_score.begin(),sub_cand->nnjm_ngram_score.end());
-            nt_num++;
+            lm_memo_hit_num++;
+            cand->lm_state = it->second.lm_state;
+            increased_lm_probs[i] = it->second.increased_lm_prob;
+            continue;
         }
-        else
+        auto slot = lm_miss_slots.insert(make_pair(key,lm_miss_cands.size()));
+        if (slot.second == false)
         {
-            cand->tgt_wids.push_back(tgt_wid);
-            cand->nnjm_ngram_score.push_back(0.0);
+            lm_memo_hit_num++;
+            lm_miss_dups.push_back(make_pair(i,slot.first->second));
+            continue;
         }
+        lm_miss_cands.push_back(cand);
+        lm_miss_indexes.push_back(i);
     }
-    for (size_t i=0;i<PROB_NUM;i++)
+    lm_miss_probs.resize(lm_miss_cands.size());
+    for (size_t b=0;b<lm_miss_cands.size();b+=LM_PREFETCH_BATCH)
     {
-        cand->trans_probs.push_back(cand_x1->trans_probs.at(i) + cand_x2->trans_probs.at(i) + rule.tgt_rule->probs.at(i));
+        size_t batch_size = min(LM_PREFETCH_BATCH,lm_miss_cands.size()-b);
+        lm_model->cal_increased_lm_scores(&lm_miss_cands[b],batch_size,&lm_miss_probs[b]);
+    }
+    for (size_t j=0;j<lm_miss_cands.size();j++)
+    {
+        Cand *cand = lm_miss_cands[j];
+        increased_lm_probs[lm_miss_indexes[j]] = lm_miss_probs[j];
+        LmMemoValue value;
+        value.increased_lm_prob = lm_miss_probs[j];
+        value.lm_state = cand->lm_state;
+        lm_memo.insert(make_pair(get_lm_memo_key(cand),value));
     }
-    cand->nnjm_prob = cal_nnjm_score(cand);
-    double increased_nnjm_prob = cand->nnjm_prob - cand_x1->nnjm_prob - cand_x2->nnjm_prob;
-    double increased_lm_prob = lm_model->cal_increased_lm_score(cand);
-    cand->lm_prob = cand_x1->lm_prob + cand_x2->lm_prob + increased_lm_prob;
-    cand->score = cand_x1->score + cand_x2->score + rule.tgt_rule->score + feature_weight.lm*increased_lm_prob
-        + feature_weight.rule_num*1 + feature_weight.glue*glue_num + feature_weight.len*rule.tgt_rule->word_num
-        + feature_weight.nnjm*increased_nnjm_prob;
+    for (const auto &dup : lm_miss_dups)
+    {
+        cands[dup.first]->lm_state = lm_miss_cands[dup.second]->lm_state;
+        increased_lm_probs[dup.first] = lm_miss_probs[dup.second];
+    }
+}
+
+LmMemoKey SentenceTranslator::get_lm_memo_key(Cand *cand)
+{
+    LmMemoKey key;
+    key.tgt_rule = cand->applied_rule.tgt_rule;
+    key.h_x1 = hash_value(cand->child_x1->lm_state);
+    key.h_x2 = cand->child_x2 != NULL ? hash_value(cand->child_x2->lm_state) : 0;
+    return key;
+}
+
+double SentenceTranslator::get_rule_lm_estimate(TgtRule *tgt_rule)
+{
+    auto it = rule_lm_estimates.find(tgt_rule);
+    if (it != rule_lm_estimates.end())
+        return it->second;
+    double lm_estimate = lm_model->cal_rule_lm_estimate(tgt_rule);
+    rule_lm_estimates.insert(make_pair(tgt_rule,lm_estimate));
+    return lm_estimate;
 }
 
 /**************************************************************************************
@@ -946,8 +1889,9 @@ void SentenceTranslator::update_cand_members(Cand* cand, Rule &rule, int rank_x1
  3. 出口参数: 更新后的candpq_merge
  4. 算法简介: a) 取比当前候选左子候选差一名的候选与当前候选的右子候选合并
               b) 取比当前候选右子候选差一名的候选与当前候选的左子候选合并
+              c) 取比当前规则目标端差一名的目标端与当前候选的两个子候选合并
 ************************************************************************************* */
-void SentenceTranslator::add_neighbours_to_pq(Cand* cur_cand, Candpq &candpq_merge,set<vector<int> > &duplicate_set)
+void SentenceTranslator::add_neighbours_to_pq(Cand* cur_cand, Candpq &candpq_merge,DuplicateSet &duplicate_set)
 {
 	if (cur_cand->rank_x2 != -1)                                                //如果生成当前候选的规则包括两个非终结符
 	{
@@ -965,6 +1909,20 @@ void SentenceTranslator::add_neighbours_to_pq(Cand* cur_cand, Candpq &candpq_mer
 		int rank_x2 = cur_cand->rank_x2;
 		generate_cand_with_rule_and_add_to_pq(cur_cand->applied_rule,rank_x1,rank_x2,candpq_merge,duplicate_set);
 	}
+
+	Rule &cur_rule = cur_cand->applied_rule;                                     //规则维度的邻居, 即源端相同的下一个目标端
+	if (cur_rule.tgt_rules != NULL && cur_rule.tgt_rule_rank+1 < cur_rule.tgt_rules->size())
+	{
+		Rule next_rule = cur_rule;
+		set_rule_rank(next_rule,cur_rule.tgt_rule_rank+1);
+		int rank_x1 = cur_cand->rank_x1;
+		int rank_x2 = cur_cand->rank_x2;
+		if (next_rule.span_x1 != cur_rule.span_x1)                              //目标端非终结符顺序改变, 子候选的排名随变量跨度交换
+		{
+			swap(rank_x1,rank_x2);
+		}
+		generate_cand_with_rule_and_add_to_pq(next_rule,rank_x1,rank_x2,candpq_merge,duplicate_set);
+	}
 }
 
 void SentenceTranslator::show_cand(Cand* cand)
@@ -972,20 +1930,18 @@ void SentenceTranslator::show_cand(Cand* cand)
     for (int i=cand->span.first;i<=cand->span.first+cand->span.second;i++)
         cout<<src_vocab->get_word(src_wids.at(i))<<' ';
     cout<<"||| ";
-    for (int i=0; i<cand->tgt_wids.size(); i++)
+    for (auto wid : get_tgt_wids(cand))
     {
-        cout<<get_tgt_word(cand->tgt_wids.at(i))<<'/';
-        cout<<src_vocab->get_word(src_wids.at(cand->aligned_src_idx.at(i)))<<'/';
-        cout<<cand->nnjm_ngram_score.at(i)<<' ';
+        cout<<get_tgt_word(wid)<<' ';
     }
-    cout<<endl;
+    cout<<"||| "<<cand->nnjm_prob<<endl;
 }
 
 void SentenceTranslator::show_rule(Rule &rule)
 {
     if (rule.tgt_rule == NULL)
         return;
-    for (int e : rule.src_ids)
+    for (int e : get_rule_src_ids(rule))
         cout<<src_vocab->get_word(e)<<' ';
     cout<<"||| ";
     for (int i=0; i<rule.tgt_rule->wids.size(); i++)
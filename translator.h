@@ -4,6 +4,11 @@
 //#include "ruletable.h"
 #include "lm.h"
 #include "myutils.h"
+#include "kbest.h"
+#include "chart.h"
+#include "phrasecache.h"
+#include "nnjmcache.h"
+#include "fastnnjm.h"
 
 struct Models
 {
@@ -13,6 +18,61 @@ struct Models
 	LanguageModel *lm_model;
     neuralLM *nnjm_model;
     set<string> *function_words;
+    PhraseCache *phrase_cache;                      //句子之间共享的短语候选缓存, 为NULL时不使用
+    NnjmCache *nnjm_cache;                          //句子之间共享的nnjm得分缓存, 为NULL时不使用
+    FastNnjm *fast_nnjm;                            //float32或int8的推理用nnjm, 为NULL时使用neuralLM的double计算
+};
+
+//超图文件(hypergraph.bin)的格式, 所有数值均为本机字节序:
+//文件头: 4字节HYPERGRAPH_MAGIC, int特征数F
+//每个句子: int句子编号, int节点数N, int边数E, int根节点数R, R个int根节点编号,
+//  N个节点(子节点在前): int跨度起始位置, int跨度长度, float节点最好推导的得分
+//  E条边: int头节点, char尾节点数T, T个int尾节点(x1在前), F个float边的局部特征值,
+//         short源端长度, 源端id序列(int), short目标端长度, 目标端符号序列(int),
+//  目标端符号非负时为目标端单词id, -1和-2分别表示第1和第2个尾节点,
+//  不大于HYPERGRAPH_OOV_BASE的符号为OOV单词, 源端id为HYPERGRAPH_OOV_BASE减去该符号
+const char HYPERGRAPH_MAGIC[] = "HGB2";
+const int HYPERGRAPH_OOV_BASE = -3;
+
+//规则语言模型打分的备忘录的键, 增加的语言模型得分和结果状态只取决于规则目标端和子候选的语言模型状态
+//子候选状态只保存64位哈希值, 规则只有一个非终结符时h_x2为0
+struct LmMemoKey
+{
+	TgtRule *tgt_rule;
+	uint64_t h_x1;
+	uint64_t h_x2;
+	bool operator==(const LmMemoKey &rhs) const { return tgt_rule == rhs.tgt_rule && h_x1 == rhs.h_x1 && h_x2 == rhs.h_x2; }
+};
+
+struct LmMemoKeyHash
+{
+	size_t operator() (const LmMemoKey &key) const
+	{
+		return util::MurmurHashNative(&key,sizeof(LmMemoKey),0);
+	}
+};
+
+//备忘录的值, 包括增加的语言模型得分和打分后的语言模型状态
+struct LmMemoValue
+{
+	double increased_lm_prob;
+	lm::ngram::ChartState lm_state;
+};
+
+//批量计算nnjm得分时, 一个目标端单词的得分为若干个ngram得分的平均值, 每个ngram得分占一个槽
+//槽的得分已经在缓存中时query_idx为-1, 否则为该ngram在待查询列表中的位置
+struct NnjmSlot
+{
+	double score;
+	int query_idx;
+};
+
+//一个目标端单词的nnjm得分项, 其得分为槽[slot_beg,slot_end)的平均值, 累加到批次中第cand_idx个候选
+struct NnjmTerm
+{
+	size_t cand_idx;
+	size_t slot_beg;
+	size_t slot_end;
 };
 
 class SentenceTranslator
@@ -23,24 +83,53 @@ class SentenceTranslator
 		vector<string> translate_sentence();
 		vector<vector<TuneInfo> > get_tune_info();
 		vector<vector<string> > get_applied_rules();
+		vector<string> get_hypergraphs();
+		pair<size_t,size_t> get_recomb_stats();
+		pair<size_t,size_t> get_lm_memo_stats() { return make_pair(lm_memo_hit_num,lm_memo_query_num); }
+		vector<CubeStats> get_cube_stats() { return cube_stats; }
 	private:
-        void fill_span2validflag();
+        bool is_valid_span(size_t beg, size_t span);
 		void fill_span2cands_with_phrase_rules();
+		void build_phrase_tgt_seq(int beg, const PhraseInfo &phrase_info, TgtRule &tgt_rule, TgtSeq &seq);
 		void fill_span2rules_with_hiero_rules();
-		void fill_span2rules_with_AX_XA_XAX_rule();
-		void fill_span2rules_with_AXB_AXBX_XAXB_rule();
-		void fill_span2rules_with_AXBXC_rule();
-		void fill_span2rules_with_glue_rule();
+		void fill_span2rules_with_AX_XA_XAX_rule(int sen_beg, int sen_end);
+		void fill_span2rules_with_AXB_AXBX_XAXB_rule(int sen_beg, int sen_end);
+		void fill_span2rules_with_AXBXC_rule(int sen_beg, int sen_end);
+		void init_glue_rule();
+		void add_glue_cands_to_pq(const size_t beg,const size_t span,Candpq &candpq_glue);
+		void generate_glue_cand_and_add_to_pq(const size_t beg,const size_t span,int len_X1,int rank_x1,int rank_x2,Candpq &candpq_glue);
+		void add_glue_neighbours_to_pq(Cand *cur_cand, Candpq &candpq_glue);
+		const vector<int>& get_rule_src_ids(const Rule &rule);
+		void prune_span2rules_with_coarse_pass();
+		double get_coarse_rule_score(TgtRule *tgt_rule);
 		void fill_span2rules_with_matched_rules(vector<TgtRule> &matched_rules,vector<int> &src_ids,pair<int,int> span,pair<int,int> span_src_x1,pair<int,int> span_src_x2);
+		void set_rule_rank(Rule &rule, int rank);
 		void generate_kbest_for_span(const size_t beg,const size_t span);
-		void generate_cand_with_rule_and_add_to_pq(Rule &rule,int rank_x1,int rank_x2,Candpq &new_cands_by_mergence,set<vector<int> > &duplicate_set);
-		void update_cand_members(Cand* cand, Rule &rule, int rank_x1, int rank_x2, Cand* cand_x1, Cand* cand_x2);
-		void add_neighbours_to_pq(Cand *cur_cand, Candpq &new_cands_by_mergence,set<vector<int> > &duplicate_set);
+		void generate_cand_with_rule_and_add_to_pq(Rule &rule,int rank_x1,int rank_x2,Candpq &new_cands_by_mergence,DuplicateSet &duplicate_set);
+		void update_cand_members(Cand* cand, const Rule &rule, int rank_x1, int rank_x2, Cand* cand_x1, Cand* cand_x2);
+		void complete_cand_members(Cand **cands, size_t cand_num);
+		void score_pending_cands_and_add_to_pq(Candpq &candpq_merge);
+		double get_rule_lm_estimate(TgtRule *tgt_rule);
+		void cal_increased_lm_scores_with_memo(Cand **cands, size_t cand_num, double *increased_lm_probs);
+		LmMemoKey get_lm_memo_key(Cand *cand);
+		void add_neighbours_to_pq(Cand *cur_cand, Candpq &new_cands_by_mergence,DuplicateSet &duplicate_set);
 		void dump_rules(vector<string> &applied_rules, Cand *cand);
 		string words_to_str(vector<int> wids, int drop_oov);
-        double cal_nnjm_score(Cand *cand);
+		void append_deriv_tgt_wids(const Deriv *deriv, vector<int> &tgt_wids);
+		vector<double> get_cand_feature_values(Cand *cand);
+		vector<double> get_deriv_feature_values(const Deriv *deriv);
+		int add_node_to_hypergraph(Cand *node, unordered_map<Cand*,int> &node_ids, string &nodes, string &edges, int &edge_num);
+		void add_edge_to_hypergraph(Cand *edge, int head, unordered_map<Cand*,int> &node_ids, string &edges);
+        double cal_nnjm_score(Cand *cand, TgtSeq &seq);
+        void collect_nnjm_queries(Cand *cand, TgtSeq &seq, size_t cand_idx);
+        void add_nnjm_slot(int src_idx, const vector<int> &tgt_context);
+        void cal_collected_nnjm_scores(double *increased_nnjm_probs, size_t cand_num);
+        double lookup_nnjm_score(int src_idx, const int *fifteen_gram);
         string get_tgt_word(int wid);
-        vector<int> get_aligned_src_idx(int beg, TgtRule &tgt_rule,Cand* cand_x1, Cand* cand_x2);
+        vector<int> get_tgt_wids(Cand *cand);
+        void append_tgt_wids(Cand *cand, vector<int> &tgt_wids);
+        void build_tgt_seq(Cand *cand, TgtSeq &seq);
+        void update_tgt_bound(Cand *cand, TgtSeq &seq);
         void show_cand(Cand *cand);
         void show_rule(Rule &rule);
 
@@ -51,22 +140,38 @@ class SentenceTranslator
 		LanguageModel *lm_model;
 		neuralLM *nnjm_model;
         set<string> *function_words;
+        PhraseCache *phrase_cache;
+        NnjmCache *nnjm_cache;
+        FastNnjm *fast_nnjm;
 		Parameter para;
 		Weight feature_weight;
+		bool keep_recombined;                           //是否保留被重组掉的候选, 输出n-best或超图时需要
 
-        vector<vector<bool> > span2validflag;           //检查每个span是否应该生成候选，跨越EOS的span不生成候选
-		vector<vector<CandBeam> > span2cands;		    //存储解码过程中所有跨度对应的候选列表, 
-													    //span2cands[i][j]存储起始位置为i, 跨度为j的候选列表
-		vector<vector<vector<Rule> > > span2rules;	    //存储每个跨度所有能用的hiero规则
+        Chart<char,CHART_ROW_MAX> span2validflag;           //检查每个span是否应该生成候选, 粗粒度剪枝时会被修改
+		Chart<CandBeam,CHART_ROW_MAX> span2cands;		    //存储解码过程中所有跨度对应的候选列表, 行的范围见chart.h
+													    //span2cands(i,j)存储起始位置为i, 跨度为j的候选列表
+		Chart<vector<Rule>,CHART_ROW_MAX> span2rules;	    //存储每个跨度所有能用的hiero规则
 
 		vector<int> src_wids;
         vector<pair<int,int> > sen_spans;
-        vector<vector<bool> > sen_span_dict;
-        vector<int> eos_indexes;
+        vector<int> sen_len_of_beg;                     //句首位置对应句子的跨度长度(实际为长度减1), 其他位置为-1
+        Rule glue_rule;                                 //glue规则模板, glue候选只引用其目标端
+        unordered_set<uint64_t> glue_visited;           //当前前缀跨度已经生成的glue候选(切分位置, 前缀排名, 后缀排名)
 		size_t src_sen_len;
 		int src_nt_id;                                  //源端非终结符的id
 		int tgt_nt_id; 									//目标端非终结符的id
         Cand* null_cand;
+        DuplicateSet duplicate_set;                     //立方体剪枝时记录已经加入优先级队列的候选, 在所有跨度之间复用
+        vector<CubeStats> cube_stats;                   //每种跨度长度的立方体剪枝统计信息
+        TgtSeq tgt_seq;                                 //生成候选时使用的压缩目标端序列, 在所有候选之间复用
+        vector<Cand*> pending_cands;                    //非延迟打分时等待批量打分后入队的候选
+        vector<double> batch_lm_probs;                  //批量打分时每个候选的语言模型得分增量
+        vector<double> batch_nnjm_probs;                //批量打分时每个候选的nnjm得分增量
+        vector<Cand*> lm_miss_cands;                    //批量打分时备忘录中没有的候选
+        vector<size_t> lm_miss_indexes;                 //未命中的候选在批次中的位置
+        vector<double> lm_miss_probs;                   //未命中的候选的语言模型得分增量
+        unordered_map<LmMemoKey,size_t,LmMemoKeyHash> lm_miss_slots;   //批次中未命中的键在lm_miss_cands中的位置, 相同的键只打分一次
+        vector<pair<size_t,size_t> > lm_miss_dups;      //批次中与之前未命中的候选键相同的候选: (在批次中的位置, 在lm_miss_cands中的位置)
 
         int src_bos_nnjm_id;                            //源端句首符号"<src>"的id
         int src_eos_nnjm_id;                            //源端句尾符号"</src>"的id
@@ -75,6 +180,19 @@ class SentenceTranslator
         int tgt_window_size;
         vector<int> src_nnjm_ids;                       //源端每个单词的nnjm id
         vector<vector<int> > src_windows;               //源端每个单词的上下文
-        map<vector<int>,double> nnjm_score_cache;       //缓存已经查询过的nnjm得分
+        vector<Eigen::VectorXd> src_window_hiddens;     //源端每个单词的上下文对nnjm第一隐层的贡献, 只在NNJM_PRECOMPUTE时使用
+        vector<vector<float> > src_window_fast_hiddens; //同上, 使用fast_nnjm时的float版本
+        vector<NnjmSlot> nnjm_slots;                    //当前批次所有ngram得分的槽
+        vector<NnjmTerm> nnjm_terms;                    //当前批次所有目标端单词的nnjm得分项
+        unordered_map<NnjmFullKey,double,NnjmFullKeyHash> nnjm_score_cache;       //不使用共享缓存时, 缓存本句已经查询过的nnjm得分
+        unordered_map<NnjmFullKey,int,NnjmFullKeyHash> nnjm_query_indexes;        //当前批次缓存中没有的ngram在待查询列表中的位置, 重复的ngram只查询一次
+        vector<int> nnjm_query_ngrams;                  //待查询的ngram, 每个占NNJM_NGRAM_SIZE个id, 依次存放
+        vector<int> nnjm_query_src_idxes;               //待查询的ngram的源端窗口中心位置
+        vector<double> nnjm_query_scores;               //待查询的ngram的得分
+        vector<const Eigen::VectorXd*> nnjm_query_partials; //待查询的ngram预先计算的源端窗口贡献, 只在NNJM_PRECOMPUTE时使用
         map<int,vector<int> > wid_to_indexes;           //记录每个词在源端段落中出现的位置
+        unordered_map<TgtRule*,double> rule_lm_estimates;   //缓存每条规则目标端的语言模型估计得分, 用于延迟打分
+        unordered_map<LmMemoKey,LmMemoValue,LmMemoKeyHash> lm_memo;     //缓存规则在给定子候选语言模型状态下的打分结果
+        size_t lm_memo_hit_num;
+        size_t lm_memo_query_num;
 };
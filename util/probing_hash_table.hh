@@ -127,6 +127,13 @@ template <class EntryT, class HashT, class EqualT = std::equal_to<typename Entry
     }
 
 
+    // Hint the cache to load the ideal bucket for key.  Probing usually stops within that line.
+    template <class Key> void Prefetch(const Key key) const {
+#ifdef __GNUC__
+      __builtin_prefetch(begin_ + (hash_(key) % buckets_));
+#endif
+    }
+
     template <class Key> bool Find(const Key key, ConstIterator &out) const {
 #ifdef DEBUG
       assert(initialized_);